@@ -1,10 +1,18 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <concepts>
+#include <cstdint>
 #include <iterator>
 #include <span>
 #include <exception>
 #include <stdexcept>
 #include <cstring>
+#include <string>
+#include <string_view>
+#include <tuple>
 #include <type_traits>
 #include <vector>
 
@@ -12,6 +20,15 @@
 class InByteStream;
 class OutByteStream;
 
+// How strings and container lengths are put on the wire
+enum class WireFormat : uint8_t {
+    // strings and containers are prefixed with their varint length
+    current,
+    // strings end with \0 and container lengths take a full size_t,
+    // only to talk to peers built before length prefixes and varints
+    legacy
+};
+
 template<typename T>
 concept serializable = requires (T value, InByteStream istr, OutByteStream ostr) {
     {istr >> value};
@@ -26,6 +43,117 @@ concept serializable_container = requires (T container, decltype(*std::declval<T
     {container.push_back(item)};
 };
 
+// Integer written in LEB128: 7 bits per byte starting from the lowest ones,
+// high bit is set on all bytes but the last. Values below 128 take a single byte.
+template<std::unsigned_integral T>
+struct varint {
+    T value;
+};
+
+// Signed integer mapped to unsigned as 0, -1, 1, -2, 2... and written as varint,
+// so that small negative values are short too
+template<std::signed_integral T>
+struct zigzag {
+    T value;
+};
+
+// Types written with their own operators instead of their bytes
+template<typename T>
+concept custom_serialized = requires (T value, InByteStream& istr, OutByteStream& ostr) {
+    {operator>>(istr, value)};
+    {operator<<(ostr, value)};
+};
+
+// Lists the fields written for a type in the given order, with no padding between them:
+//     struct Info { ENetAddress address; uint64_t id; SERIALIZED_FIELDS(address.host, address.port, id) };
+// Types with only fixed size fields get a wire size known at compile time.
+#define SERIALIZED_FIELDS(...) \
+    auto serialized_fields() { return std::tie(__VA_ARGS__); } \
+    auto serialized_fields() const { return std::tie(__VA_ARGS__); }
+
+template<typename T>
+concept reflected = requires (T& value, const T& const_value) {
+    {value.serialized_fields()};
+    {const_value.serialized_fields()};
+};
+
+// Bytes the type takes on the wire, zero if it depends on the value
+template<typename T>
+constexpr size_t wire_size() {
+    if constexpr (reflected<T>) {
+        return []<typename... Fields>(std::tuple<Fields...>*) {
+            if constexpr (((wire_size<std::remove_cvref_t<Fields>>() != 0) && ...)) {
+                return (wire_size<std::remove_cvref_t<Fields>>() + ... + size_t(0));
+            } else {
+                return size_t(0);
+            }
+        }(static_cast<decltype(std::declval<T&>().serialized_fields())*>(nullptr));
+    } else if constexpr (std::is_trivially_copyable_v<T> && !custom_serialized<T>) {
+        return sizeof(T);
+    } else {
+        return 0;
+    }
+}
+
+template<typename T>
+inline constexpr size_t wire_size_v = wire_size<T>();
+
+template<typename T>
+concept fixed_size_reflected = reflected<T> && wire_size_v<T> != 0;
+
+// Writes the fields at offsets known at compile time, out must hold wire_size_v<T> bytes
+template<fixed_size_reflected T>
+void pack_to(const T& value, std::byte* out) {
+    std::apply([&out](const auto&... fields) {
+        ([&out](const auto& field) {
+            using field_t = std::remove_cvref_t<decltype(field)>;
+            if constexpr (reflected<field_t>) {
+                pack_to(field, out);
+            } else {
+                memcpy(out, &field, sizeof(field));
+            }
+            out += wire_size_v<field_t>;
+        }(fields), ...);
+    }, value.serialized_fields());
+}
+
+template<fixed_size_reflected T>
+void unpack_from(const std::byte* in, T& value) {
+    std::apply([&in](auto&... fields) {
+        ([&in](auto& field) {
+            using field_t = std::remove_cvref_t<decltype(field)>;
+            if constexpr (reflected<field_t>) {
+                unpack_from(in, field);
+            } else {
+                memcpy(&field, in, sizeof(field));
+            }
+            in += wire_size_v<field_t>;
+        }(fields), ...);
+    }, value.serialized_fields());
+}
+
+// Packs into a buffer on the stack
+template<fixed_size_reflected T>
+std::array<std::byte, wire_size_v<T>> pack(const T& value) {
+    std::array<std::byte, wire_size_v<T>> bytes;
+    pack_to(value, bytes.data());
+    return bytes;
+}
+
+template<fixed_size_reflected T>
+T unpack(std::span<const std::byte, wire_size_v<T>> bytes) {
+    T value;
+    unpack_from(bytes.data(), value);
+    return value;
+}
+
+// Vectors whose elements can be copied in bulk, the bytes are the same as of element-wise writes
+template<typename T>
+concept bulk_vector = std::same_as<T, std::vector<typename T::value_type>>
+    && std::is_trivially_copyable_v<typename T::value_type>
+    && !custom_serialized<typename T::value_type>
+    && !reflected<typename T::value_type>;
+
 class InByteStream {
 public:
     template<typename T>
@@ -46,7 +174,7 @@ public:
     }
 
     template<typename T>
-    std::enable_if_t<std::is_trivially_copyable_v<T>, void> read(T& item) {
+    std::enable_if_t<std::is_trivially_copyable_v<T> && !reflected<T>, void> read(T& item) {
         decltype(m_buffer)::iterator::difference_type size = sizeof(item);
         if (size > std::distance(m_cursor, m_buffer.end())) {
             throw std::out_of_range("Not enough bytes to read");
@@ -56,25 +184,86 @@ public:
         m_cursor += size;
     }
 
+    // Contents of the container are replaced, elements it already has are read into
+    // so that their memory is reused
     template <serializable_container Container>
     void read(Container& item) {
         using value_t = std::remove_reference_t<decltype(*item.begin())>;
-        auto size = get<size_t>();
-        item.reserve(size);
-        for (size_t i = 0; i < size; ++i) {
-            item.push_back(get<value_t>());
+        auto size = read_length();
+        if constexpr (bulk_vector<Container>) {
+            auto bytes = take(size, sizeof(value_t));
+            item.resize(size);
+            memcpy(item.data(), bytes, size * sizeof(value_t));
+        } else if constexpr (requires { item.resize(size); }) {
+            // every element takes at least a byte, so a bogus size fails before allocating too much
+            if (size > size_t(std::distance(m_cursor, m_buffer.end()))) {
+                throw std::out_of_range("Not enough bytes to read container");
+            }
+            item.resize(size);
+            for (auto& element : item) {
+                *this >> element;
+            }
+        } else {
+            item.clear();
+            item.reserve(size);
+            for (size_t i = 0; i < size; ++i) {
+                item.push_back(get<value_t>());
+            }
         }
     }
 
+    // Fixed size types are checked for bounds once and copied field by field
+    template<reflected T>
+    void read(T& item) {
+        if constexpr (wire_size_v<T> != 0) {
+            unpack_from(take(1, wire_size_v<T>), item);
+        } else {
+            std::apply([this](auto&... fields) { (*this >> ... >> fields); }, item.serialized_fields());
+        }
+    }
 
+    // Reuses the memory of str if it is big enough
     void read(std::string& str) {
-        auto char_ptr = reinterpret_cast<char*>(&(*m_cursor));
-        auto len = strlen(char_ptr);
-        if (int64_t(len) > std::distance(m_cursor, m_buffer.end())) {
+        str.assign(get<std::string_view>());
+    }
+
+    // Borrows the string from the buffer, valid as long as the buffer is
+    void read(std::string_view& str) {
+        if (m_wire_format == WireFormat::current) {
+            auto size = read_varint<size_t>();
+            str = std::string_view(reinterpret_cast<const char*>(take(size, 1)), size);
+            return;
+        }
+        auto remaining = size_t(std::distance(m_cursor, m_buffer.end()));
+        auto char_ptr = reinterpret_cast<const char*>(m_buffer.data() + (m_buffer.size() - remaining));
+        auto end = static_cast<const char*>(memchr(char_ptr, 0, remaining));
+        if (end == nullptr) {
             throw std::out_of_range("Not enough bytes to read string");
         }
-        str = std::string(char_ptr, len);
-        m_cursor += int64_t(len) + 1;
+        str = std::string_view(char_ptr, size_t(end - char_ptr));
+        m_cursor += int64_t(str.size()) + 1;
+    }
+
+    void set_wire_format(WireFormat format) {
+        m_wire_format = format;
+    }
+
+    // Borrows an array written as a container from the buffer, valid as long as the buffer is.
+    // Only for byte-aligned types, as the packet gives no alignment guarantees.
+    template<typename T>
+    requires (std::is_trivially_copyable_v<T> && alignof(T) == 1)
+    void read(std::span<const T>& span) {
+        auto size = read_length();
+        span = std::span<const T>(reinterpret_cast<const T*>(take(size, sizeof(T))), size);
+    }
+
+    // Next size bytes as a stream of their own, this one skips them
+    InByteStream substream(size_t size) {
+        auto offset = m_buffer.size() - size_t(std::distance(m_cursor, m_buffer.end()));
+        take(size, 1);
+        InByteStream result(m_buffer.data() + offset, size);
+        result.set_wire_format(m_wire_format);
+        return result;
     }
 
     template<typename T>
@@ -92,6 +281,49 @@ public:
 protected:
     std::span<std::byte> m_buffer;
     std::span<std::byte>::iterator m_cursor = m_buffer.begin();
+    WireFormat m_wire_format = WireFormat::current;
+
+    template<std::unsigned_integral T>
+    T read_varint() {
+        T value = 0;
+        for (uint32_t shift = 0; shift < sizeof(T) * 8; shift += 7) {
+            auto byte = uint8_t(get<std::byte>());
+            value |= T(T(byte & 0x7f) << shift);
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+        throw std::out_of_range("Malformed varint");
+    }
+
+    size_t read_length() {
+        return m_wire_format == WireFormat::current ? read_varint<size_t>() : get<size_t>();
+    }
+
+    template<std::unsigned_integral T>
+    friend InByteStream& operator>>(InByteStream& istr, varint<T>& item) {
+        item.value = istr.read_varint<T>();
+        return istr;
+    }
+
+    template<std::signed_integral T>
+    friend InByteStream& operator>>(InByteStream& istr, zigzag<T>& item) {
+        using unsigned_t = std::make_unsigned_t<T>;
+        auto value = istr.read_varint<unsigned_t>();
+        item.value = T((value >> 1) ^ unsigned_t(-(value & 1)));
+        return istr;
+    }
+
+    // Skips count items of the given size, returns where they begin
+    const std::byte* take(size_t count, size_t item_size) {
+        auto remaining = size_t(std::distance(m_cursor, m_buffer.end()));
+        if (item_size != 0 && count > remaining / item_size) {
+            throw std::out_of_range("Not enough bytes to read array");
+        }
+        auto begin = m_buffer.data() + (m_buffer.size() - remaining);
+        m_cursor += int64_t(count * item_size);
+        return begin;
+    }
 
 };
 
@@ -99,34 +331,59 @@ class OutByteStream {
 public:
     OutByteStream(size_t initial_size = 20) : m_buffer(initial_size) { }
 
+    // Reuses memory of the given buffer, its contents are overwritten
+    explicit OutByteStream(std::vector<std::byte>&& buffer) : m_buffer(std::move(buffer)) {
+        m_buffer.resize(std::max(m_buffer.capacity(), size_t(20)));
+    }
+
     template<typename T>
-    std::enable_if_t<std::is_trivially_copyable_v<T>, void> write(const T& item) {
+    std::enable_if_t<std::is_trivially_copyable_v<T> && !reflected<T>, void> write(const T& item) {
         auto size = sizeof(item);
-        if (size > m_buffer.size() - m_cursor) {
-            m_buffer.resize(m_buffer.size() + size);
-        }
+        reserve(size);
 
         memcpy(get_write_address(), &item, size);
         m_cursor += size;
     }
 
+    template<reflected T>
+    void write(const T& item) {
+        if constexpr (wire_size_v<T> != 0) {
+            reserve(wire_size_v<T>);
+            pack_to(item, get_write_address());
+            m_cursor += wire_size_v<T>;
+        } else {
+            std::apply([this](const auto&... fields) { (*this << ... << fields); }, item.serialized_fields());
+        }
+    }
+
     void write(const std::string& str) {
-        auto char_ptr = str.c_str();
-        auto len = str.size() + 1;
-        if (len > m_buffer.size() - m_cursor) {
-            m_buffer.resize(m_buffer.size() + len);
+        write(std::string_view(str));
+    }
+
+    void write(std::string_view str) {
+        if (m_wire_format == WireFormat::current) {
+            write_varint(str.size());
+            if (!str.empty()) {
+                write(std::as_bytes(std::span(str.data(), str.size())));
+            }
+            return;
         }
-        if (*(char_ptr + len - 1) != 0) {
-            throw std::runtime_error("string should end with \\0");
+        if (str.find('\0') != std::string_view::npos) {
+            throw std::runtime_error("string should not contain \\0");
         }
-        memcpy(get_write_address(), char_ptr, len);
+        auto len = str.size() + 1;
+        reserve(len);
+        memcpy(get_write_address(), str.data(), str.size());
+        m_buffer[m_cursor + str.size()] = std::byte(0);
         m_cursor += len;
     }
 
+    void set_wire_format(WireFormat format) {
+        m_wire_format = format;
+    }
+
     void write(const std::span<const std::byte>& bytes) {
-        if (bytes.size() > m_buffer.size() - m_cursor) {
-            m_buffer.resize(m_buffer.size() + bytes.size());
-        }
+        reserve(bytes.size());
         memcpy(get_write_address(), bytes.data(), bytes.size());
         m_cursor += bytes.size();
     }
@@ -138,9 +395,18 @@ public:
 
     template<serializable_container Container>
     void write(const Container& container) {
-        write(container.size());
-        for (size_t i = 0; i < container.size(); ++i) {
-            *this << container[i];
+        write_length(container.size());
+        if constexpr (bulk_vector<Container>) {
+            auto size = container.size() * sizeof(typename Container::value_type);
+            reserve(size);
+            if (size != 0) {
+                memcpy(get_write_address(), container.data(), size);
+            }
+            m_cursor += size;
+        } else {
+            for (size_t i = 0; i < container.size(); ++i) {
+                *this << container[i];
+            }
         }
     }
 
@@ -154,12 +420,194 @@ public:
         return std::span<std::byte>(m_buffer.begin(), m_cursor);
     }
 
+    size_t size() const {
+        return m_cursor;
+    }
+
+    // Makes sure that the next `bytes` bytes are written without reallocation.
+    // Buffer grows at least twice, so writing many small values is amortized O(1).
+    void reserve(size_t bytes) {
+        if (bytes > m_buffer.size() - m_cursor) {
+            m_buffer.resize(std::max(m_buffer.size() * 2, m_cursor + bytes));
+        }
+    }
+
+    // Starts writing from the beginning, keeping the memory
+    void reset() {
+        m_cursor = 0;
+    }
+
+    // Gives away written bytes, stream is empty afterwards
+    std::vector<std::byte> release() {
+        m_buffer.resize(m_cursor);
+        m_cursor = 0;
+        return std::move(m_buffer);
+    }
+
 protected:
     std::vector<std::byte> m_buffer;
     size_t m_cursor = 0;
+    WireFormat m_wire_format = WireFormat::current;
+
+    void write_varint(uint64_t value) {
+        while (value >= 0x80) {
+            write(std::byte((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        write(std::byte(value));
+    }
+
+    void write_length(size_t size) {
+        if (m_wire_format == WireFormat::current) {
+            write_varint(size);
+        } else {
+            write(size);
+        }
+    }
+
+    template<std::unsigned_integral T>
+    friend OutByteStream& operator<<(OutByteStream& ostr, const varint<T>& item) {
+        ostr.write_varint(item.value);
+        return ostr;
+    }
+
+    template<std::signed_integral T>
+    friend OutByteStream& operator<<(OutByteStream& ostr, const zigzag<T>& item) {
+        using unsigned_t = std::make_unsigned_t<T>;
+        auto value = unsigned_t(item.value);
+        ostr.write_varint(unsigned_t(unsigned_t(value << 1) ^ unsigned_t(-(value >> (sizeof(T) * 8 - 1)))));
+        return ostr;
+    }
 
     std::byte* get_write_address() {
-        return &(*(m_buffer.begin() + int64_t(m_cursor)));
+        return m_buffer.data() + m_cursor;
+    }
+};
+
+// Fixed point representation of floats from [min, max) with the given step
+struct FixedPoint {
+    constexpr FixedPoint(float min, float max, float step)
+        : min(min), max(max), step(step), bits(bits_for_range(max - min, step)) {}
+
+    float min;
+    float max;
+    float step;
+    uint32_t bits;
+
+    static constexpr uint32_t bits_for_range(float range, float step) {
+        uint32_t bits = 0;
+        while (float(uint64_t(1) << bits) * step < range) {
+            ++bits;
+        }
+        return bits;
+    }
+
+    uint32_t quantize(float value) const {
+        auto max_value = uint32_t((uint64_t(1) << bits) - 1);
+        if (!(value > min)) {
+            return 0;
+        }
+        auto steps = std::round((value - min) / step);
+        return steps >= float(max_value) ? max_value : uint32_t(steps);
+    }
+
+    float dequantize(uint32_t value) const {
+        return min + float(value) * step;
+    }
+};
+
+// Packs values with arbitrary bit widths into bytes of an OutByteStream.
+// flush() has to be called after the last value, it pads the last byte with zeros.
+class BitWriter {
+public:
+    explicit BitWriter(OutByteStream& stream) : m_stream(stream) {}
+
+    void write(uint32_t value, uint32_t bits) {
+        if (bits < 32) {
+            value &= (1u << bits) - 1;
+        }
+        m_scratch |= uint64_t(value) << m_scratch_bits;
+        m_scratch_bits += bits;
+        while (m_scratch_bits >= 8) {
+            m_stream << std::byte(m_scratch & 0xff);
+            m_scratch >>= 8;
+            m_scratch_bits -= 8;
+        }
+    }
+
+    void write(float value, const FixedPoint& format) {
+        write(format.quantize(value), format.bits);
     }
+
+    void write(bool value) {
+        write(uint32_t(value), 1);
+    }
+
+    // Elias gamma code, small values take few bits: 0 takes 1 bit, 1-2 take 3 bits, 3-6 take 5 bits...
+    void write_gamma(uint32_t value) {
+        auto shifted = uint64_t(value) + 1;
+        uint32_t length = 0;
+        while ((shifted >> (length + 1)) != 0) {
+            ++length;
+        }
+        for (uint32_t i = 0; i < length; ++i) {
+            write(false);
+        }
+        write(true);
+        write(uint32_t(shifted & ((uint64_t(1) << length) - 1)), length);
+    }
+
+    void flush() {
+        if (m_scratch_bits > 0) {
+            m_stream << std::byte(m_scratch & 0xff);
+        }
+        m_scratch = 0;
+        m_scratch_bits = 0;
+    }
+
+private:
+    OutByteStream& m_stream;
+    uint64_t m_scratch = 0;
+    uint32_t m_scratch_bits = 0;
 };
 
+// Reads values written by BitWriter, takes bytes from the stream only when they are needed
+class BitReader {
+public:
+    explicit BitReader(InByteStream& stream) : m_stream(stream) {}
+
+    uint32_t read(uint32_t bits) {
+        while (m_scratch_bits < bits) {
+            m_scratch |= uint64_t(m_stream.get<std::byte>()) << m_scratch_bits;
+            m_scratch_bits += 8;
+        }
+        auto value = uint32_t(m_scratch & ((uint64_t(1) << bits) - 1));
+        m_scratch >>= bits;
+        m_scratch_bits -= bits;
+        return value;
+    }
+
+    float read(const FixedPoint& format) {
+        return format.dequantize(read(format.bits));
+    }
+
+    bool read_bool() {
+        return read(1) != 0;
+    }
+
+    uint32_t read_gamma() {
+        uint32_t length = 0;
+        while (!read_bool()) {
+            if (++length > 32) {
+                throw std::out_of_range("Malformed gamma code");
+            }
+        }
+        auto shifted = (uint64_t(1) << length) | read(length);
+        return uint32_t(shifted - 1);
+    }
+
+private:
+    InByteStream& m_stream;
+    uint64_t m_scratch = 0;
+    uint32_t m_scratch_bits = 0;
+};
@@ -0,0 +1,104 @@
+#include <spdlog/spdlog.h>
+#include "common.hpp"
+#include "socket_tools.h"
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <cxxopts.hpp>
+
+
+// Floods the server on localhost from many client sockets and counts the broadcasts that come back.
+// Every message is broadcast to all clients, so the server handles received / clients messages.
+int main(int argc, char** argv) {
+    cxxopts::Options options("load_generator");
+    options.add_options()
+        ("p,port", "Specify port", cxxopts::value<std::string>()->default_value(s_port))
+        ("c,clients", "Number of client sockets", cxxopts::value<size_t>()->default_value("16"))
+        ("d,duration", "Seconds to run", cxxopts::value<size_t>()->default_value("5"))
+        ("b,burst", "Datagrams sent by every client between reads", cxxopts::value<size_t>()->default_value("8"))
+        ("h,help", "Show help")
+        ;
+    auto parsed = options.parse(argc, argv);
+    if (parsed.count("h") > 0) {
+        std::cout << options.help() << '\n';
+        return 0;
+    }
+    auto port = parsed["p"].as<std::string>();
+    auto num_clients = parsed["c"].as<size_t>();
+    auto duration = std::chrono::seconds(parsed["d"].as<size_t>());
+    auto burst = parsed["b"].as<size_t>();
+
+    using steady_clock = std::chrono::steady_clock;
+    struct load_client {
+        int socket;
+        addrinfo server;
+    };
+
+    std::vector<load_client> clients(num_clients);
+    for (size_t i = 0; i < clients.size(); ++i) {
+        clients[i].socket = create_dgram_socket("localhost", port.c_str(), &clients[i].server);
+        if (clients[i].socket < 0) {
+            spdlog::error("could not create client socket {}", i);
+            return 1;
+        }
+        auto id = fmt::format("load {}", i);
+        check_error(sendto(clients[i].socket, id.data(), id.size(), 0, clients[i].server.ai_addr, clients[i].server.ai_addrlen));
+    }
+
+    auto send_to_server = [](const load_client& client, std::string_view message) {
+        // a full socket buffer only means the server is behind
+        return sendto(client.socket, message.data(), message.size(), 0, client.server.ai_addr, client.server.ai_addrlen) > 0;
+    };
+
+    auto drain = [](const load_client& client) {
+        size_t received = 0;
+        while (recv(client.socket, s_message_buffer, s_max_message_size, MSG_DONTWAIT) > 0) {
+            ++received;
+        }
+        return received;
+    };
+
+    // let the server register everyone before measuring
+    usleep(200'000);
+    for (const auto& client : clients) {
+        drain(client);
+    }
+
+    constexpr auto message = "load"sv;
+    size_t sent = 0;
+    size_t received = 0;
+    auto start = steady_clock::now();
+    auto last_heartbeat = start;
+    while (steady_clock::now() - start < duration) {
+        if (steady_clock::now() - last_heartbeat > std::chrono::milliseconds(s_heartbeat_delay_millis)) {
+            last_heartbeat = steady_clock::now();
+            for (const auto& client : clients) {
+                send_to_server(client, s_heartbeat_msg);
+            }
+        }
+        for (const auto& client : clients) {
+            for (size_t i = 0; i < burst; ++i) {
+                if (send_to_server(client, message)) {
+                    ++sent;
+                }
+            }
+        }
+        for (const auto& client : clients) {
+            received += drain(client);
+        }
+    }
+    auto seconds = std::chrono::duration<double>(steady_clock::now() - start).count();
+
+    for (const auto& client : clients) {
+        close(client.socket);
+    }
+
+    spdlog::info("{} clients: sent {:.0f} datagrams/s, got {:.0f} broadcast datagrams/s back, server handled about {:.0f} messages/s",
+            clients.size(), double(sent) / seconds, double(received) / seconds,
+            double(received) / double(clients.size()) / seconds);
+}
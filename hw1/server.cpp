@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <chrono>
 #include <functional>
 #include <spdlog/spdlog.h>
@@ -10,12 +11,14 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <compare>
+#include <vector>
 #include <cxxopts.hpp>
 
 
 struct user_info {
-    std::string addr;
-    uint16_t port;
+    // both in network byte order, as they come in sockaddr_in
+    in_addr_t addr;
+    in_port_t port;
     auto operator<=>(const user_info&) const = default;
 };
 
@@ -23,15 +26,15 @@ struct client_info {
     using clock_t = std::chrono::steady_clock;
 
     std::string id;
+    // kept to send to the client without converting its address every time
+    sockaddr_in address;
     clock_t::time_point last_heartbeat{clock_t::now()};
 };
 
 template <>
 struct std::hash<user_info> {
     size_t operator()(const user_info& item) const {
-        auto h1 = std::hash<std::string>{}(item.addr);
-        auto h2 = std::hash<int>{}(item.port);
-        return h1 ^ (h2 << 1);
+        return std::hash<uint64_t>{}((uint64_t(item.addr) << 16) | item.port);
     }
 };
 
@@ -44,16 +47,64 @@ struct fmt::formatter<user_info> {
 
     template <typename FormatContext>
     auto format(const user_info& info, FormatContext& ctx) -> decltype(ctx.out()) {
-        return format_to(ctx.out(), "{} (port {})", info.addr, info.port);
+        return format_to(ctx.out(), "{} (port {})", inet_ntoa(in_addr{info.addr}), ntohs(info.port));
     }
 };
 
+// Buffers for recvmmsg, so that one syscall takes all datagrams that are already queued
+class ReceiveBatch {
+public:
+    explicit ReceiveBatch(size_t size)
+        : m_buffers(size)
+        , m_addresses(size)
+        , m_iovecs(size)
+        , m_headers(size)
+    {
+        for (size_t i = 0; i < size; ++i) {
+            m_iovecs[i] = {.iov_base = m_buffers[i].data(), .iov_len = m_buffers[i].size()};
+            m_headers[i].msg_hdr.msg_iov = &m_iovecs[i];
+            m_headers[i].msg_hdr.msg_iovlen = 1;
+        }
+    }
+
+    // Returns the number of datagrams read, they are valid until the next call
+    size_t receive(int socket) {
+        for (size_t i = 0; i < m_headers.size(); ++i) {
+            m_headers[i].msg_hdr.msg_name = &m_addresses[i];
+            m_headers[i].msg_hdr.msg_namelen = sizeof(m_addresses[i]);
+        }
+        auto received = recvmmsg(socket, m_headers.data(), unsigned(m_headers.size()), MSG_DONTWAIT, nullptr);
+        if (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            check_error(received);
+        }
+        return received > 0 ? size_t(received) : 0;
+    }
+
+    std::string_view message(size_t i) const {
+        return {m_buffers[i].data(), m_headers[i].msg_len};
+    }
+
+    const sockaddr_storage& address(size_t i) const {
+        return m_addresses[i];
+    }
+
+private:
+    std::vector<std::array<char, s_max_message_size>> m_buffers;
+    std::vector<sockaddr_storage> m_addresses;
+    std::vector<iovec> m_iovecs;
+    std::vector<mmsghdr> m_headers;
+};
+
+// sendmmsg takes at most this many messages at once
+static constexpr size_t s_max_send_batch = 1024;
+
 
 
 int main(int argc, char** argv) {
     cxxopts::Options options("server");
     options.add_options()
         ("p,port", "Specify port", cxxopts::value<std::string>()->default_value(s_port))
+        ("b,batch", "Datagrams taken per wakeup with recvmmsg, 1 reads and sends them one by one", cxxopts::value<size_t>()->default_value("64"))
         ("h,help", "Show help")
         ;
     auto parsed = options.parse(argc, argv);
@@ -62,7 +113,8 @@ int main(int argc, char** argv) {
         return 0;
     }
     auto port = parsed["p"].as<std::string>();
-    spdlog::info("starting server");
+    auto batch_size = std::max(parsed["b"].as<size_t>(), size_t(1));
+    spdlog::info("starting server, taking up to {} datagrams per wakeup", batch_size);
     Epoll epoll;
     epoll.set_timeout(5000);
     
@@ -71,10 +123,10 @@ int main(int argc, char** argv) {
 
     std::unordered_map<user_info, client_info> clients;
 
-    auto register_client = [&](user_info client, size_t bytes_read) {
-        if (bytes_read > 0) {
-            std::string client_id { s_message_buffer, bytes_read };
-            clients.insert({client, {client_id}});
+    auto register_client = [&](user_info client, const sockaddr_in& address, std::string_view message) {
+        if (!message.empty()) {
+            std::string client_id { message };
+            clients.insert({client, {client_id, address}});
             spdlog::info("registered new client! id = {}; info = {}", client_id, client);
         } else {
             spdlog::error("warn user tried to register with empty name. Denying");
@@ -82,47 +134,73 @@ int main(int argc, char** argv) {
 
     };
 
+    std::vector<mmsghdr> broadcast_headers;
     auto broadcast_message = [&](const std::string& message) {
-            for (auto [user, client] : clients) {
-                sockaddr_in address;
-                in_addr inet_addr;
-                check_error(inet_aton(user.addr.c_str(), &inet_addr));
-                address.sin_family = AF_INET;
-                address.sin_addr = inet_addr;
-                address.sin_port = ntohs(user.port);
+        if (batch_size == 1) {
+            for (const auto& [user, client] : clients) {
                 check_error(sendto(
                             server, 
                             message.c_str(), 
                             message.size(), 
                             0, 
-                            reinterpret_cast<const sockaddr*>(&address), 
-                            sizeof(address))
+                            reinterpret_cast<const sockaddr*>(&client.address), 
+                            sizeof(client.address))
                 );
             }
+            return;
+        }
+        // every datagram points to the same payload, only the address differs
+        iovec payload = {.iov_base = const_cast<char*>(message.data()), .iov_len = message.size()};
+        broadcast_headers.clear();
+        for (auto& [user, client] : clients) {
+            mmsghdr header = {};
+            header.msg_hdr.msg_name = &client.address;
+            header.msg_hdr.msg_namelen = sizeof(client.address);
+            header.msg_hdr.msg_iov = &payload;
+            header.msg_hdr.msg_iovlen = 1;
+            broadcast_headers.push_back(header);
+        }
+        for (size_t sent = 0; sent < broadcast_headers.size();) {
+            auto count = std::min(broadcast_headers.size() - sent, s_max_send_batch);
+            auto result = check_error(sendmmsg(server, broadcast_headers.data() + sent, unsigned(count), 0));
+            if (result <= 0) {
+                break;
+            }
+            sent += size_t(result);
+        }
     };
 
-    auto process_client_input = [&](const sockaddr_in& address, size_t bytes_read) {
-        user_info info { inet_ntoa(address.sin_addr), ntohs(address.sin_port) };
+    auto process_client_input = [&](const sockaddr_in& address, std::string_view client_message) {
+        user_info info { address.sin_addr.s_addr, address.sin_port };
         auto id = clients.find(info);
         if (id == clients.end()) {
             // still not registered
-            return register_client(info, bytes_read);
+            return register_client(info, address, client_message);
         } 
         
-        if (bytes_read > 0) {
-            std::string_view client_message(s_message_buffer, bytes_read);
+        if (!client_message.empty()) {
             if (client_message == s_heartbeat_msg) {
-                spdlog::info("Huge success(heartbeat) {}", info);
+                spdlog::debug("Huge success(heartbeat) {}", info);
                 id->second.last_heartbeat = client_info::clock_t::now();
                 return;
             }
-            spdlog::info("got message {} from client {}({})", client_message, id->second.id, info);
+            spdlog::debug("got message {} from client {}({})", client_message, id->second.id, info);
             std::string answer = fmt::format("Broadcasting message from, client {}: \"{}\"", id->second.id, client_message);
-            spdlog::info("Broadcasting {}", answer);
+            spdlog::debug("Broadcasting {}", answer);
             broadcast_message(answer);
         }
     };
 
+    // not an IPv4 address gives nullptr
+    auto as_ipv4 = [](const auto& address) -> const sockaddr_in* {
+        if (address.ss_family != AF_INET) {
+            spdlog::error("cannot process not ip4 connections (got {})", address.ss_family);
+            return nullptr;
+        }
+        return reinterpret_cast<const sockaddr_in*>(&address);
+    };
+
+    ReceiveBatch batch(batch_size);
     while (true) {
         epoll.wait();
         auto events = epoll.get_events();
@@ -141,18 +219,24 @@ int main(int argc, char** argv) {
                 continue;
             }
             
-            sockaddr client_address;
+            if (batch_size > 1) {
+                auto received = batch.receive(server);
+                for (size_t i = 0; i < received; ++i) {
+                    if (auto address = as_ipv4(batch.address(i))) {
+                        process_client_input(*address, batch.message(i));
+                    }
+                }
+                continue;
+            }
+
+            sockaddr_storage client_address;
             memset(&client_address, 0, sizeof(client_address));
             socklen_t address_len = sizeof(client_address);
-            auto read = check_error(recvfrom(server, s_message_buffer, s_max_message_size, 0, &client_address, &address_len));
+            auto read = check_error(recvfrom(server, s_message_buffer, s_max_message_size, 0, reinterpret_cast<sockaddr*>(&client_address), &address_len));
 
-            if (client_address.sa_family != AF_INET) {
-                spdlog::error("cannot process not ip4 connections (got {})", client_address.sa_family);
-                continue;
-            }
-            auto& actual_address = reinterpret_cast<sockaddr_in&>(client_address);
-            if (read > 0) {
-                process_client_input(actual_address, size_t(read));
+            auto address = as_ipv4(client_address);
+            if (address != nullptr && read > 0) {
+                process_client_input(*address, std::string_view(s_message_buffer, size_t(read)));
             }
         }
 
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
+#include <span>
 #include <stdexcept>
 #include <thread>
 
@@ -32,54 +35,123 @@ inline ENetHost* create_host(uint16_t port) {
             incoming_bandwith, 
             outcoming_bandwith
     );
-    spdlog::info("created host on port {}", server->address.port);
-
     if (server == nullptr) {
         throw std::runtime_error("could node create enet server");
     }
 
+    spdlog::info("created host on port {}", server->address.port);
+
     return server;
 }
 
+enum class ScheduleMode {
+    // network is polled once a frame, then the loop sleeps until the end of the frame
+    fixed_frame,
+    // loop waits for network events until the next task deadline,
+    // packets are processed as soon as they arrive and update() runs as a task
+    event_driven
+};
+
 template<typename Derived>
 class BaseServer {
 public:
     BaseServer(ENetHost* host): m_host(host) {}
 
     void run() {
+        start();
+        if constexpr (Derived::s_schedule_mode == ScheduleMode::event_driven) {
+            while (m_alive) {
+                step(time_until(next_deadline()));
+            }
+        } else {
+            auto& self = get_self();
+            while (m_alive) {
+                auto frame_start = game_clock_t::now();
+                auto frame_end = frame_start + Derived::s_update_time;
+                process_events(0);
+                m_task_manager.launch();
+                self.update();
+                std::this_thread::sleep_until(frame_end);
+            }
+        }
+        finish();
+    }
+
+    // Parts of the event driven loop, for the hosts running many servers on their own threads
+
+    void start() {
         auto& self = get_self();
         self.on_start();
-        while (m_alive) {
-            auto frame_start = game_clock_t::now();
-            auto frame_end = frame_start + Derived::s_update_time;
-            ENetEvent event;
-            while(enet_host_service(m_host , &event, 0) > 0) {
-                if (event.type == ENET_EVENT_TYPE_CONNECT) {
-                    self.process_new_connection(event);
-                } else if (event.type == ENET_EVENT_TYPE_RECEIVE) {
-                    self.process_data(event);
-                } else if (event.type == ENET_EVENT_TYPE_NONE) {
-                    spdlog::info("no events event");
-                } else if (event.type == ENET_EVENT_TYPE_DISCONNECT) {
-                    self.process_disconnect(event);
-                } else {
-                    spdlog::warn("unsupported network event type: {}", event.type);
-                }
-            }
-            m_task_manager.launch();
-            self.update();
-            std::this_thread::sleep_until(frame_end);
+        if constexpr (Derived::s_schedule_mode == ScheduleMode::event_driven) {
+            m_task_manager.add_task([&self] { self.update(); return true; }, Derived::s_update_time);
+        }
+    }
+
+    // Launches due tasks, then handles network events waiting up to timeout_ms for the first one
+    void step(uint32_t timeout_ms) {
+        static_assert(Derived::s_schedule_mode == ScheduleMode::event_driven);
+        m_task_manager.launch();
+        process_events(timeout_ms);
+    }
+
+    void finish() {
+        get_self().on_finish();
+    }
+
+    game_clock_t::time_point next_deadline() const {
+        return m_task_manager.next_deadline();
+    }
+
+    bool alive() const {
+        return m_alive;
+    }
+
+    ENetHost* host() const {
+        return m_host;
+    }
+
+    // Rounded up, so the loop doesn't spin during the last millisecond before a deadline.
+    // Never longer than a frame, so tasks added while waiting are not delayed too much.
+    static uint32_t time_until(game_clock_t::time_point deadline) {
+        auto now = game_clock_t::now();
+        if (deadline <= now) {
+            return 0;
         }
-        self.on_finish();
+        auto wait = std::min(std::chrono::ceil<std::chrono::milliseconds>(deadline - now), Derived::s_update_time);
+        return uint32_t(wait.count());
     }
 
     auto& get_self() {
         return static_cast<Derived&>(*this);
     }
 
+    std::span<ENetPeer> get_peers() {
+        return {m_host->peers,  m_host->peerCount};
+    }
+
 protected:
     TimedTaskManager<game_clock_t> m_task_manager;
     ENetHost* m_host;
     bool m_alive = true;
-};
 
+private:
+    // Waits up to timeout_ms for the first event, then handles everything that is already queued
+    void process_events(uint32_t timeout_ms) {
+        auto& self = get_self();
+        ENetEvent event;
+        while(enet_host_service(m_host , &event, timeout_ms) > 0) {
+            timeout_ms = 0;
+            if (event.type == ENET_EVENT_TYPE_CONNECT) {
+                self.process_new_connection(event);
+            } else if (event.type == ENET_EVENT_TYPE_RECEIVE) {
+                self.process_data(event);
+            } else if (event.type == ENET_EVENT_TYPE_NONE) {
+                spdlog::info("no events event");
+            } else if (event.type == ENET_EVENT_TYPE_DISCONNECT) {
+                self.process_disconnect(event);
+            } else {
+                spdlog::warn("unsupported network event type: {}", event.type);
+            }
+        }
+    }
+};
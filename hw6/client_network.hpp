@@ -2,15 +2,17 @@
 
 #include <algorithm>
 #include <iterator>
-#include <sstream>
 #include <string>
 #include <tuple>
 #include <iostream>
+#include <optional>
 #include <ranges>
 
 #include <enet/enet.h>
 
 #include "client_state.hpp"
+#include "message_batch.hpp"
+#include "snapshot.hpp"
 #include "spdlog/spdlog.h"
 
 
@@ -43,8 +45,11 @@ public:
     Network(ClientState& state): state(state) {
         std::tie(client, matchmaking) = setup_enet();
         atexit(enet_deinitialize);
+        // retried until the connection to matchmaking is up, then changes come by themselves
         state.tasks.add_task([this]{
-            ask_for_lobby_update();
+            if (lobby_version == s_no_lobby_version && !subscribed) {
+                subscribe_to_lobbies();
+            }
             return true;
         }, 1s);
         
@@ -60,7 +65,7 @@ public:
                     return true;
                 }
                 OutByteStream msg;
-                msg << MessageType::lobby_join << state.chosen_lobby << state.name;
+                msg << MessageType::lobby_join << varint{state.chosen_lobby} << state.name;
                 send_bytes<true>(msg.get_span(), matchmaking);
             } else if (state.should_create) {
                 state.should_create = false;
@@ -71,10 +76,18 @@ public:
                 state.lobby_creation.description = fmt::format("{}'s lobby", state.name);
                 if (matchmaking->state != ENET_PEER_STATE_CONNECTED) {
                     matchmaking = connect_to_matchmaking(client);
+                    lobby_version = s_no_lobby_version;
+                    subscribed = false;
                 }
                 state.lobby_creation.max_players = 16;
                 msg << MessageType::lobby_create << state.lobby_creation;
                 send_bytes<true>(msg.get_span(), matchmaking);
+            } else if (state.should_queue) {
+                state.should_queue = false;
+                spdlog::info("joining the matchmaking queue with mmr {}", state.mmr);
+                OutByteStream msg;
+                msg << MessageType::queue_join << state.name << state.mmr;
+                send_bytes<true>(msg.get_span(), matchmaking);
             }
             return true;
         }, 50ms);
@@ -96,8 +109,9 @@ public:
         {
             ++processed_enet_events;
             if (net_event.type == ENET_EVENT_TYPE_RECEIVE) {
-                InByteStream istr(net_event.packet->data, net_event.packet->dataLength);
-                process_data(istr, net_event.packet);
+                for_each_message(*net_event.packet, [&](InByteStream& istr) {
+                    process_data(istr, net_event.packet);
+                });
                 enet_packet_destroy(net_event.packet);
             }
         }
@@ -109,18 +123,19 @@ private:
     ENetPeer* matchmaking;
     ClientState& state;
     ENetAddress server_address;
+    // bigger than the server history, so any baseline server may choose is still here
+    static constexpr uint32_t s_received_history_size = 64;
+    SnapshotHistory<s_received_history_size> received_snapshots;
+    ObjectsSnapshot decoded_snapshot;
+    uint32_t last_snapshot_sequence = s_no_snapshot;
+    // start of the game is timed from lobby_start until the first snapshot
+    std::optional<game_clock_t::time_point> lobby_start_time;
+    std::chrono::milliseconds server_wait = 0ms;
+    uint32_t lobby_version = s_no_lobby_version;
+    bool subscribed = false;
 
-    Snapshot parse_snapshot(InByteStream& istr) {
-        uint32_t num_objects;
-        istr >> num_objects;
-        std::vector<GameObject> objects;
-        objects.reserve(num_objects);
-        for (uint32_t i = 0; i < num_objects; ++i) {
-            GameObject obj;
-            istr >> obj;
-            objects.push_back(std::move(obj));
-        }
-        return {objects, state.my_object, state.direction, game_clock_t::now()};
+    Snapshot make_snapshot(std::vector<GameObject>&& objects) {
+        return {std::move(objects), state.my_object, state.direction, game_clock_t::now()};
     }
 
     void lobby_controls() {
@@ -137,32 +152,62 @@ private:
 
     void process_snapshot(InByteStream& istr) {
         spdlog::debug("Got snapshot from the server");
-        state.snapshots.push_back(parse_snapshot(istr));
+        // decoded into the same buffer every time, so reading doesn't allocate once it has grown
+        auto& snapshot = decoded_snapshot;
+        if (!read_snapshot(istr, received_snapshots, snapshot)) {
+            spdlog::warn("baseline of snapshot {} is unknown, skipping it", snapshot.sequence);
+            return;
+        }
+        // such a late snapshot would take the ring slot of the baseline that is still acked
+        if (last_snapshot_sequence != s_no_snapshot && snapshot.sequence + s_received_history_size <= last_snapshot_sequence) {
+            spdlog::debug("snapshot {} is too old to keep, dropping it", snapshot.sequence);
+            return;
+        }
+        received_snapshots.push(snapshot.sequence).objects = snapshot.objects;
+        if (last_snapshot_sequence != s_no_snapshot && snapshot.sequence < last_snapshot_sequence) {
+            // arrived too late to be shown, but still can be used as a baseline
+            return;
+        }
+        last_snapshot_sequence = snapshot.sequence;
+        if (lobby_start_time.has_value()) {
+            auto connection = std::chrono::duration_cast<std::chrono::milliseconds>(game_clock_t::now() - *lobby_start_time);
+            spdlog::info("first snapshot {} ms after the lobby was ready ({} ms waiting for the server, {} ms connecting)",
+                    (server_wait + connection).count(), server_wait.count(), connection.count());
+            lobby_start_time.reset();
+        }
+        // vectors of the snapshots already shown are reused, so once they have grown nothing is allocated
+        std::vector<GameObject> objects;
+        if (!state.spare_objects.empty()) {
+            objects = std::move(state.spare_objects.back());
+            state.spare_objects.pop_back();
+        }
+        objects.assign(snapshot.objects.begin(), snapshot.objects.end());
+        state.snapshots.push_back(make_snapshot(std::move(objects)));
     }
 
     void process_registration(InByteStream& istr) {
         istr >> state.my_info;
         spdlog::info("my id is {}, my object id is {}", state.my_info.client_id, state.my_info.controlled_object_id);
-        state.last_snapshot = parse_snapshot(istr);
+        std::vector<GameObject> objects;
+        read_objects(istr, objects);
+        state.last_snapshot = make_snapshot(std::move(objects));
         state.my_object = *std::ranges::find_if(state.last_snapshot.objects, [&](const auto& obj) {return obj.id == state.my_info.controlled_object_id;});
         state.mode = ClientMode::connected;
         state.tasks.add_task([&]{
             // send data to the server
-            OutByteStream message;
+            auto message = acquire_packet_stream();
             message << MessageType::input;
-            message << state.direction;
-            send_bytes<false>(message.get_span(), server);
+            message << state.direction << varint{last_snapshot_sequence};
+            send_stream<false>(std::move(message), server);
             return true;
         }, 10ms);
     }
 
     void process_ping(InByteStream& istr) {
-        uint32_t num_players;
-        istr >> num_players;
+        auto num_players = istr.get<varint<uint32_t>>().value;
         for (uint32_t i = 0; i < num_players; ++i) {
-            uint32_t id;
-            uint32_t ping;
-            istr >> id >> ping;
+            auto id = istr.get<varint<uint32_t>>().value;
+            auto ping = istr.get<varint<uint32_t>>().value;
             auto player = std::find_if(state.players.begin(), state.players.end(), 
                     [&](const Player& player) {return player.id == id;});
             if (player == state.players.end()) {
@@ -174,16 +219,9 @@ private:
     }
 
     void process_lobby_list_update(InByteStream& istr) {
-        state.lobbies.clear();
-        auto sz = istr.get<size_t>();
-        state.lobbies.reserve(sz);
-        for (size_t i = 0; i < sz; ++i) {
-            state.lobbies.push_back(istr.get<client_lobby_t>());
-            std::stringstream debug;
-            debug << state.lobbies.back().name << ":\n";
-            std::ranges::copy(state.lobbies[i].players | std::views::transform([](const auto& player) {return player.name;}), std::ostream_iterator<std::string>(debug));
-            //spdlog::warn("{}", debug.str());
-        }
+        lobby_version = istr.get<varint<uint32_t>>().value;
+        // lobbies already on screen keep their strings, so names are decoded without allocating
+        istr >> state.lobbies;
     }
 
     void process_data(InByteStream& istr, const auto& packet) {
@@ -195,12 +233,16 @@ private:
         } else if (type == MessageType::register_player) {
             process_registration(istr);
         } else if (type == MessageType::list_update) {
-            state.players.emplace_back(istr.get<LobbyPlayer>());
+            state.players.emplace_back(istr.get<Player>());
         } else if (type == MessageType::ping) {
             process_ping(istr);
         } else if (type == MessageType::lobby_list_update) {
             process_lobby_list_update(istr);
+        } else if (type == MessageType::lobby_diff) {
+            process_lobby_diff(istr);
         } else if (type == MessageType::lobby_join) {
+            // lobbies formed from the queue are not chosen by the player
+            state.chosen_lobby = istr.get<varint<size_t>>().value;
             state.mode = ClientMode::in_lobby;
         } else if (type == MessageType::lobby_start) {
             connect_to_game_server(istr);
@@ -210,6 +252,8 @@ private:
     void connect_to_game_server(InByteStream& istr) {
         state.mode = ClientMode::connecting;
         auto server_info = istr.get<GameServerInfo>();
+        server_wait = std::chrono::milliseconds(istr.get<varint<uint32_t>>().value);
+        lobby_start_time = game_clock_t::now();
         server_address.port = server_info.address.port;
         enet_address_set_host(&server_address, "localhost");
         //server_address = server_info.address;
@@ -240,10 +284,26 @@ private:
         } 
     }
 
-    void ask_for_lobby_update() {
+    void process_lobby_diff(InByteStream& istr) {
+        auto version = istr.get<varint<uint32_t>>().value;
+        if (lobby_version == s_no_lobby_version || version <= lobby_version) {
+            // full list is on its way or already has this change
+            return;
+        }
+        if (version != lobby_version + 1 || !apply_lobby_change(state.lobbies, istr)) {
+            spdlog::warn("lobby list is out of sync (version {}, got change {}), asking for the full list", lobby_version, version);
+            lobby_version = s_no_lobby_version;
+            subscribe_to_lobbies();
+            return;
+        }
+        lobby_version = version;
+    }
+
+    // Server answers with the full lobby list and then sends every change
+    void subscribe_to_lobbies() {
         OutByteStream msg;
-        msg << MessageType::lobby_list_update;
-        send_bytes<false>(msg.get_span(), matchmaking);
+        msg << MessageType::lobby_subscribe;
+        subscribed = send_bytes<true>(msg.get_span(), matchmaking) == 0;
     }
 
     const int max_events_in_frame = 100;
@@ -1,10 +1,14 @@
 #pragma once
 
+#include <utility>
+
 #include "common.hpp"
 #include "client_state.hpp"
 #include "glm/geometric.hpp"
 #include "spdlog/spdlog.h"
 #include "game_server.hpp"
+#include "physics_kernels.hpp"
+#include "snapshot.hpp"
 
 
 class Physics {
@@ -29,11 +33,12 @@ public:
             // there's snapshot available and previous was finished.
             // moving to the next spanphot
             state.snapshot_progress = 0;
-            state.last_snapshot = state.snapshots.front();
+            std::swap(state.last_snapshot, state.snapshots.front());
 
             state.objects = state.last_snapshot.objects;
             
             check_reset();
+            state.spare_objects.push_back(std::move(state.snapshots.front().objects));
             state.snapshots.pop_front();
         }
 
@@ -45,13 +50,20 @@ public:
 
         auto& next_snapshot = state.snapshots.front();
         float snapshot_ratio = float(state.snapshot_progress) / float(GameServer::s_update_time / s_client_frame_time);
+        // objects enter and leave the area of interest, so snapshots are matched by id (both are sorted by it)
+        const auto& last_objects = state.last_snapshot.objects;
+        const auto& next_objects = next_snapshot.objects;
+        size_t next_idx = 0;
         for (size_t i = 0; i < state.objects.size(); ++i) {
-            if (i == next_snapshot.objects.size()) {
+            while (next_idx < next_objects.size() && next_objects[next_idx].id < last_objects[i].id) {
+                ++next_idx;
+            }
+            if (next_idx == next_objects.size()) {
                 break;
             }
-            state.objects[i].position = interpolate(state.last_snapshot.objects[i].position, next_snapshot.objects[i].position, snapshot_ratio);
-            state.objects[i].velocity = interpolate(state.last_snapshot.objects[i].velocity, next_snapshot.objects[i].velocity, snapshot_ratio);
-            state.objects[i].radius = interpolate(state.last_snapshot.objects[i].radius, next_snapshot.objects[i].radius, snapshot_ratio);
+            if (next_objects[next_idx].id == last_objects[i].id) {
+                state.objects[i] = interpolate(last_objects[i], next_objects[next_idx], snapshot_ratio);
+            }
         }
 
 
@@ -67,8 +79,8 @@ private:
             float speed = GameServer::speed_of_object(object);
             object.velocity = direction * speed;
         }
-        GameServer::object_physics(object, dt);
-        GameServer::object_borders(object);
+        // bit-identical to the server kernels, so prediction matches the server
+        integrate_object(object, dt, s_simulation_borders);
     }
 
     void check_reset() {
@@ -82,7 +94,9 @@ private:
             spdlog::error("cannot find my object in snapshot");
         } else {
             GameObject snapshot_object = *(iter);
-            if (snapshot_object.radius != snapshot.my_object.radius || glm::distance(snapshot_object.position, snapshot.my_object.position) > 0.1f) {
+            // radius comes quantized, so it is compared with the wire precision
+            bool radius_changed = std::abs(snapshot_object.radius - snapshot.my_object.radius) > s_object_format.radius.step;
+            if (radius_changed || glm::distance(snapshot_object.position, snapshot.my_object.position) > 0.1f) {
                 spdlog::warn("resetting physics");
                 GameObject new_estimation = snapshot_object;
 
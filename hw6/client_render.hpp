@@ -68,6 +68,9 @@ public:
                     if (key == ALLEGRO_KEY_SPACE) {
                         state.should_create = true;
                     }
+                    if (key == ALLEGRO_KEY_Q) {
+                        state.should_queue = true;
+                    }
                 } else if (state.mode == ClientMode::in_lobby) {
                     if (key == ALLEGRO_KEY_ENTER) {
                         state.send_ready = true;
@@ -123,6 +126,11 @@ public:
             al_flip_display();
         } else if (state.mode == ClientMode::in_lobby) {
             al_clear_to_color(al_map_rgb(0, 0, 0));
+            if (state.chosen_lobby >= state.lobbies.size()) {
+                // lobby formed from the queue, it comes with the next lobby list change
+                al_flip_display();
+                return;
+            }
             al_draw_text(font, al_map_rgb(255, 255, 255), 0, 0, 0, fmt::format("In lobby \"{}\"", state.lobbies[state.chosen_lobby].name).c_str());
             auto& players = state.lobbies[state.chosen_lobby].players;
             for (size_t i = 0; i < players.size(); ++i) {
@@ -30,6 +30,8 @@ struct ClientState {
     size_t chosen_lobby;
     bool should_connect = false;
     bool should_create = false;
+    bool should_queue = false;
+    uint16_t mmr = 1500;
     bool send_ready = false;
     client_lobby_t lobby_creation = {};
     GameObject my_object;
@@ -37,6 +39,8 @@ struct ClientState {
     uint32_t interpolation_progress;
     uint32_t interpolation_length;
     std::deque<Snapshot> snapshots;
+    // object vectors of shown snapshots, new snapshots are copied into them
+    std::vector<std::vector<GameObject>> spare_objects;
     Snapshot last_snapshot;
     uint32_t snapshot_progress = 0;
     vec2 direction = {0, 0};
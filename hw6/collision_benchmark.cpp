@@ -0,0 +1,83 @@
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "common.hpp"
+#include "spatial_grid.hpp"
+
+
+static constexpr int s_ticks = 5;
+static const float s_max_radius = max_object_radius(s_simulation_borders);
+
+static ObjectStore generate_objects(size_t count, vec2 borders, std::mt19937& generator) {
+    std::uniform_real_distribution<float> x_distribution(0.0f, borders.x);
+    std::uniform_real_distribution<float> y_distribution(0.0f, borders.y);
+    std::uniform_real_distribution<float> radius_distribution(0.2f, 1.0f);
+    ObjectStore objects;
+    objects.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        objects.push_back({
+            .position = {x_distribution(generator), y_distribution(generator)},
+            .velocity = {0, 0},
+            .radius = radius_distribution(generator),
+            .id = uint32_t(i)
+        });
+    }
+    return objects;
+}
+
+static auto make_teleport(vec2 borders, std::mt19937& generator) {
+    return [borders, &generator](GameObject& obj) {
+        std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+        obj.position = {distribution(generator) * borders.x, distribution(generator) * borders.y};
+    };
+}
+
+template<typename F>
+static double measure_ms(F&& func) {
+    auto start = std::chrono::steady_clock::now();
+    func();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+int main() {
+    for (size_t count : {100ul, 1'000ul, 10'000ul, 50'000ul}) {
+        // arena grows with population, so that density matches a 100 object room
+        auto borders = s_simulation_borders * std::sqrt(float(count) / 100.0f);
+        std::mt19937 generator(42);
+        auto naive_objects = generate_objects(count, borders, generator);
+        auto grid_objects = naive_objects;
+
+        std::mt19937 naive_generator(7);
+        auto naive_teleport = make_teleport(borders, naive_generator);
+        std::mt19937 grid_generator(7);
+        auto grid_teleport = make_teleport(borders, grid_generator);
+        SpatialGrid grid(borders);
+
+        // first tick resolves overlaps of the random spawn and builds the grid
+        resolve_collisions_naive(naive_objects, s_max_radius, naive_teleport);
+        resolve_collisions(grid_objects, grid, s_max_radius, grid_teleport);
+
+        auto naive_time = measure_ms([&] {
+            for (int tick = 0; tick < s_ticks; ++tick) {
+                resolve_collisions_naive(naive_objects, s_max_radius, naive_teleport);
+            }
+        }) / s_ticks;
+        auto grid_time = measure_ms([&] {
+            for (int tick = 0; tick < s_ticks; ++tick) {
+                resolve_collisions(grid_objects, grid, s_max_radius, grid_teleport);
+            }
+        }) / s_ticks;
+
+        bool same = naive_objects.x == grid_objects.x
+            && naive_objects.y == grid_objects.y 
+            && naive_objects.radius == grid_objects.radius;
+
+        spdlog::info("{:>6} objects: naive {:>10.3f} ms/tick, grid {:>8.3f} ms/tick, speedup x{:.1f}{}",
+                count, naive_time, grid_time, naive_time / grid_time, same ? "" : " (RESULTS DIFFER)");
+    }
+}
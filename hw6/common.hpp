@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
 #include <chrono>
 #include <string>
@@ -25,6 +26,8 @@ struct ClientInfo {
 struct GameServerInfo {
     ENetAddress address;
     uint64_t id;
+
+    SERIALIZED_FIELDS(address.host, address.port, id)
 };
 
 using color_t = glm::vec< 4, uint8_t, glm::defaultp >;
@@ -57,8 +60,12 @@ enum class MessageType: uint8_t {
     register_player, reset, input, 
     lobby_list_update, lobby_start, lobby_create, 
     lobby_join, register_provider, server_ready,
-    set_name, player_ready
-    
+    set_name, player_ready,
+    warm_server_ready, assign_lobby,
+    provider_load, lobby_subscribe, lobby_diff,
+    queue_join, queue_leave,
+    // several messages in one packet, see message_batch.hpp
+    batch
 };
 
 template<typename T>
@@ -83,21 +90,24 @@ struct PlayerAddress {
     bool operator==(const PlayerAddress& other) const {
         return host == other.host && port == other.port;
     }
+
+    SERIALIZED_FIELDS(host, port)
+};
+
+template<>
+struct std::hash<PlayerAddress> {
+    size_t operator()(const PlayerAddress& address) const {
+        return std::hash<uint64_t>{}((uint64_t(address.host) << 16) | address.port);
+    }
 };
 
 struct LobbyPlayer {
     std::string name;
     PlayerAddress address;
     bool ready;
-};
-
-inline OutByteStream& operator<<(OutByteStream& stream, const LobbyPlayer& player) {
-    return stream << player.name << player.address.host << player.address.port << player.ready;
-}
 
-inline InByteStream& operator>>(InByteStream& stream, LobbyPlayer& player) {
-    return stream >> player.name >> player.address.host >> player.address.port >> player.ready;
-}
+    SERIALIZED_FIELDS(name, address, ready)
+};
 
 struct Player : public LobbyPlayer {
     bool operator<(const Player& right) const {
@@ -106,29 +116,102 @@ struct Player : public LobbyPlayer {
 
     uint32_t id;
     uint32_t ping;
+
+    SERIALIZED_FIELDS(name, address, ready, id, ping)
 };
 
-inline OutByteStream& operator<<(OutByteStream& ostr, const Player& player) {
-    ostr << static_cast<const LobbyPlayer&>(player);
-    ostr << player.id << player.ping;
-    return ostr;
+
+template<bool is_reliable>
+constexpr enet_uint32 packet_flags() {
+    return is_reliable ? ENET_PACKET_FLAG_RELIABLE : ENET_PACKET_FLAG_UNSEQUENCED;
+}
+
+template<bool is_reliable>
+constexpr enet_uint8 packet_channel() {
+    return is_reliable ? 0 : 1;
+}
+
+template<bool is_reliable>
+inline ENetPacket* create_packet(const std::span<std::byte>& bytes) {
+    return enet_packet_create(bytes.data(), bytes.size(), packet_flags<is_reliable>());
+}
+
+// Buffers of packets created from streams come back here once enet is done with them
+inline std::vector<bytes_t>& packet_buffer_pool() {
+    thread_local std::vector<bytes_t> pool;
+    return pool;
 }
-inline InByteStream& operator>>(InByteStream& istr, Player& player) {
-    istr >> static_cast<LobbyPlayer&>(player);
-    istr >> player.id >> player.ping;
-    return istr;
+
+// more buffers than this are given back to the allocator
+static constexpr size_t s_max_pooled_buffers = 256;
+
+inline void release_packet_buffer(bytes_t&& buffer) {
+    auto& pool = packet_buffer_pool();
+    if (pool.size() < s_max_pooled_buffers) {
+        pool.push_back(std::move(buffer));
+    }
+}
+
+// Stream writing into a pooled buffer, size_hint bytes can be written without reallocation
+inline OutByteStream acquire_packet_stream(size_t size_hint = 0) {
+    auto& pool = packet_buffer_pool();
+    if (pool.empty()) {
+        return OutByteStream(std::max(size_hint, size_t(64)));
+    }
+    auto buffer = std::move(pool.back());
+    pool.pop_back();
+    OutByteStream stream(std::move(buffer));
+    stream.reserve(size_hint);
+    return stream;
 }
 
+// Packet takes the stream's buffer instead of copying it (ENET_PACKET_FLAG_NO_ALLOCATE)
+template<bool is_reliable>
+inline ENetPacket* create_packet(OutByteStream&& stream) {
+    auto buffer = new bytes_t(stream.release());
+    auto packet = enet_packet_create(buffer->data(), buffer->size(), packet_flags<is_reliable>() | ENET_PACKET_FLAG_NO_ALLOCATE);
+    packet->userData = buffer;
+    packet->freeCallback = [](ENetPacket* packet) {
+        auto buffer = static_cast<bytes_t*>(packet->userData);
+        release_packet_buffer(std::move(*buffer));
+        delete buffer;
+    };
+    return packet;
+}
 
 template<bool is_reliable>
 inline int send_bytes(const std::span<std::byte>& bytes, ENetPeer* where) {
-    const auto reliability_flag = is_reliable ? ENET_PACKET_FLAG_RELIABLE : ENET_PACKET_FLAG_UNSEQUENCED;
-    const auto channel_number = is_reliable ? 0 : 1;
-    auto packet = enet_packet_create(bytes.data(), bytes.size(), reliability_flag); //TODO: add NO_ALLOC after debug
+    return enet_peer_send(where, packet_channel<is_reliable>(), create_packet<is_reliable>(bytes));
+}
 
-    return enet_peer_send(where, channel_number, packet);
+// Sends the stream's buffer without copying it, it goes back to the pool afterwards
+template<bool is_reliable>
+inline int send_stream(OutByteStream&& stream, ENetPeer* where) {
+    auto packet = create_packet<is_reliable>(std::move(stream));
+    auto result = enet_peer_send(where, packet_channel<is_reliable>(), packet);
+    if (result != 0) {
+        enet_packet_destroy(packet);
+    }
+    return result;
+}
 
-    // enet_packet_destroy(packet);
+// Enqueues the same packet to every connected peer accepted by the filter.
+// Enet reference counts packets, so the payload is allocated and copied once for all of them.
+template<bool is_reliable, typename Filter>
+inline size_t send_to_peers(ENetPacket* packet, std::span<ENetPeer> peers, Filter&& filter) {
+    size_t sent = 0;
+    for (auto& peer : peers) {
+        if (peer.state != ENET_PEER_STATE_CONNECTED || !filter(peer)) {
+            continue;
+        }
+        if (enet_peer_send(&peer, packet_channel<is_reliable>(), packet) == 0) {
+            ++sent;
+        }
+    }
+    if (packet->referenceCount == 0) {
+        enet_packet_destroy(packet);
+    }
+    return sent;
 }
 
 template<typename T>
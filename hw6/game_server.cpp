@@ -1,20 +1,27 @@
 #include "game_server.hpp"
 #include "glm/geometric.hpp"
 #include "spdlog/spdlog.h"
+#include "status_display.hpp"
 #include <algorithm>
-#include <ftxui/dom/elements.hpp> 
-#include <ftxui/dom/table.hpp> 
-#include <ftxui/screen/screen.hpp>
 #include <stdexcept>
 #include <thread>
+#include <unistd.h>
 
 
-GameServer::GameServer(ENetHost* host, const std::string& name, uint32_t id) 
+GameServer::GameServer(
+        ENetHost* host, const std::string& name, uint32_t id,
+        std::chrono::milliseconds status_period,
+        uint16_t proxy_port
+)
         : BaseServer<GameServer>(host)
         , m_name(name)
         , m_id(id)
         , m_start_time(game_clock_t::now())
+        , m_proxy_port(proxy_port)
 {
+    if (status_period > 0ms) {
+        m_status = std::make_unique<StatusDisplay>(status_period);
+    }
     m_task_manager.add_task([this](){ send_ping(); return true;}, 100ms);
 
     m_task_manager.add_task([this]()
@@ -23,8 +30,17 @@ GameServer::GameServer(ENetHost* host, const std::string& name, uint32_t id)
             update_players();
             return true;
         }, 
-        s_update_time);
-        
+        s_update_time, 0ms, MissedRuns::catch_up);
+
+    // warm server waits for players only after it gets a lobby
+    if (m_proxy_port == 0) {
+        schedule_idle_shutdown();
+    }
+
+    spdlog::set_level(spdlog::level::info);
+}
+
+void GameServer::schedule_idle_shutdown() {
     m_task_manager.add_task([this] {
         if (m_players.empty()) {
             m_alive = false;
@@ -32,77 +48,101 @@ GameServer::GameServer(ENetHost* host, const std::string& name, uint32_t id)
         }
         return true;
     }, 10s, 20s);
-
-    spdlog::set_level(spdlog::level::info);
 }
 
 
+GameServer::~GameServer() = default;
+
 void GameServer::process_new_connection(ENetEvent& event) {
     spdlog::info("new connection on port {}", event.peer->address.port);
+    if (event.peer == matchmaking) {
+        register_in_matchmaking();
+    } else if (event.peer == m_proxy) {
+        int32_t pid = getpid();
+        OutByteStream msg;
+        msg << MessageType::warm_server_ready << pid;
+        send_bytes<true>(msg.get_span(), m_proxy);
+    }
 }
 
 void GameServer::process_data(ENetEvent& event) {
-    InByteStream istr(event.packet->data, event.packet->dataLength);
+    for_each_message(*event.packet, [&](InByteStream& istr) {
+        process_message(event, istr);
+    });
+}
+
+void GameServer::process_message(ENetEvent& event, InByteStream& istr) {
     MessageType type;
     istr >> type;
     if (type == MessageType::game_update) {
         spdlog::error("game updates from clients are deprecated");
         vec2 position;
         istr >> position;
-        auto player = get_player(event.peer->address);
-        if (player == m_players.end()) {
+        auto player = get_player(*event.peer);
+        if (player == nullptr) {
             spdlog::warn("there's an imposter on this address: {}:{}", event.peer->address.host, event.peer->address.port);
             return;
         }
         auto object = get_object_from_player(*player);
-        if (object == m_game_objects.end()) {
+        if (object == SlotIndex::s_invalid) {
             return;
         }
 
-        object->position = position;
+        m_game_objects.set_position(object, position);
     } else if (type == MessageType::input) {
         vec2 direction;
         istr >> direction;
-        direction = glm::normalize(direction);
-        if (direction.x != direction.x || glm::length(direction) < 0.1f) {
+        auto acked_snapshot = istr.get<varint<uint32_t>>().value;
+        auto player = get_player(*event.peer);
+        if (player == nullptr) {
+            spdlog::warn("there's an imposter on this address: {}:{}", event.peer->address.host, event.peer->address.port);
             return;
         }
-        auto player = get_player(event.peer->address);
-        if (player == m_players.end()) {
-            spdlog::warn("there's an imposter on this address: {}:{}", event.peer->address.host, event.peer->address.port);
+        auto& session = m_sessions.at(player->id);
+        if (session.acked_snapshot == s_no_snapshot || (acked_snapshot != s_no_snapshot && acked_snapshot > session.acked_snapshot)) {
+            session.acked_snapshot = acked_snapshot;
+        }
+
+        direction = glm::normalize(direction);
+        if (direction.x != direction.x || glm::length(direction) < 0.1f) {
             return;
         }
         auto object = get_object_from_player(*player);
-        if (object == m_game_objects.end()) {
+        if (object == SlotIndex::s_invalid) {
             return;
         }
-        object->velocity = direction * speed_of_object(*object);
+        m_game_objects.set_velocity(object, direction * speed_of_object(m_game_objects.get(object)));
     } else if (type == MessageType::register_player) {
-        auto name = istr.get<std::string>();
-        auto player = create_player(event.peer->address, name);
+        auto name = istr.get<std::string_view>();
+        auto player = add_player(create_player(event.peer->address, name));
+        attach_player(*event.peer, player.id);
         spdlog::info("added player {}", player.name);
         broadcast_new_player(player);
         
-        auto new_object = create_game_object();
-        m_game_objects.push_back(new_object);
-        m_player_to_object.insert({player.id, new_object.id});
-
-        OutByteStream register_message;
-        register_message << MessageType::register_player;
-        register_message << player.id << new_object.id;
-        write_objects(register_message);
-        send_bytes<true>(register_message.get_span(), event.peer);
-
+        auto new_object_id = add_object(create_game_object());
+        auto& session = m_sessions.insert({player.id, PlayerSession{.object_id = new_object_id}}).first->second;
+
+        m_grid.update(m_game_objects);
+        session.interest.update(m_game_objects, m_grid, find_object(new_object_id));
+        ObjectsSnapshot snapshot;
+        take_snapshot(snapshot, session.interest);
+        m_message.reset();
+        m_message << MessageType::register_player;
+        m_message << player.id << new_object_id;
+        write_objects(m_message, snapshot.objects);
+        m_batcher.add<true>(event.peer, m_message.get_span());
+
+        // the list goes in as few packets as fit, with the next tick's updates
         for (const auto& old_player : m_players) {
-            OutByteStream out;
-            out << MessageType::list_update << old_player;
-            send_bytes<true>(out.get_span(), event.peer);
+            if (old_player.id == player.id) {
+                continue;
+            }
+            m_message.reset();
+            m_message << MessageType::list_update << old_player;
+            m_batcher.add<true>(event.peer, m_message.get_span());
         }
-        
-        event.peer->data = new uint32_t(player.id);
-
-        add_player(player);
-        
+    } else if (type == MessageType::assign_lobby && event.peer == m_proxy) {
+        assign_lobby(istr.get<std::string>());
     } else {
         spdlog::warn("unsupported message type from client: {}", type);
     }
@@ -110,19 +150,36 @@ void GameServer::process_data(ENetEvent& event) {
 
 void GameServer::process_disconnect(ENetEvent& event) {
     spdlog::info("peer on port {} disconnected", event.peer->address.port);
-    auto player = get_player(event.peer->address);
-    delete static_cast<uint32_t*>(event.peer->data);
-    auto obj_mapping = m_player_to_object.find(player->id);
-    auto obj = std::find_if(m_game_objects.begin(), m_game_objects.end(), [&](const auto& o) {return o.id == obj_mapping->second;});
-    m_player_to_object.erase(obj_mapping);
-    m_game_objects.erase(obj);
-    m_players.erase(player); 
+    if (event.peer == m_proxy) {
+        if (m_name.empty()) {
+            spdlog::warn("proxy has gone before assigning a lobby, closing the server");
+            m_alive = false;
+        }
+        m_proxy = nullptr;
+        return;
+    }
+    m_batcher.discard(event.peer);
+    auto player = get_player(*event.peer);
+    event.peer->data = nullptr;
+    if (player == nullptr) {
+        return;
+    }
+    auto session = m_sessions.find(player->id);
+    remove_object(session->second.object_id);
+    m_sessions.erase(session);
+    remove_player(player->id);
 }
 
 void GameServer::on_start() {
     for (int i = 0; i < 3; ++i) {
         spawn_robot();
     }
+    if (m_proxy_port != 0) {
+        ENetAddress address;
+        enet_address_set_host(&address, "localhost");
+        address.port = m_proxy_port;
+        m_proxy = enet_host_connect(m_host, &address, 2, 0);
+    }
 
 }
 
@@ -131,142 +188,133 @@ void GameServer::on_finish() {
 }
 
 void GameServer::update() {
-    if (!m_connected) {
+    if (!m_registered) {
         if (matchmaking == nullptr) {
             ENetAddress address;
             enet_address_set_host(&address, "localhost");
             address.port = s_matchmaking_server_port;
             matchmaking = enet_host_connect(m_host, &address, 2, 0);
         } else {
-            OutByteStream msg;
-            msg << MessageType::server_ready << m_name << m_host->address.host << m_host->address.port << m_id;
-            spdlog::info("registering with matchmaking server...");
-            if (send_bytes<true>(msg.get_span(), matchmaking) == 0) {
-                m_connected = true;
-            }
+            register_in_matchmaking();
         }
     }
 
     process_robots();
     processs_collisions();
-    update_screen();
+    publish_status();
 }
 
-void GameServer::update_screen() {
-    using namespace ftxui;
-    std::vector<std::vector<Element>> table_data;
-    table_data.reserve(m_players.size() + 1);
-    auto header_data = { "id", "login", "ping", "ip", "port" };
-    std::vector<Element> header;
-    header.reserve(header_data.size());
-    std::transform(header_data.begin(), header_data.end(), std::back_inserter(header), [](const auto& item) { return text(item); });
-    table_data.push_back(std::move(header));
-    for (const auto& player : m_players) {
-        auto row_data = { 
-            std::to_string(player.id), 
-            player.name, 
-            std::to_string(player.ping), 
-            std::to_string(player.address.host), 
-            std::to_string(player.address.port) 
-        };
-        std::vector<Element> row;
-        std::transform(row_data.begin(), row_data.end(), std::back_inserter(row), [](const auto& item) { return text(item); });
-        table_data.push_back(std::move(row));            
+// Does nothing until the server has a lobby and the connection to matchmaking is up,
+// update() retries it
+void GameServer::register_in_matchmaking() {
+    if (m_registered || m_name.empty() || matchmaking == nullptr) {
+        return;
     }
+    OutByteStream msg;
+    msg << MessageType::server_ready << m_name << GameServerInfo{m_host->address, m_id};
+    spdlog::info("registering with matchmaking server...");
+    if (send_bytes<true>(msg.get_span(), matchmaking) == 0) {
+        m_registered = true;
+    }
+}
 
-    auto table = Table(table_data);
-
-    table.SelectAll().Border(LIGHT);
-
-    table.SelectColumn(0).Border(LIGHT);
-
-    table.SelectRow(0).Decorate(bold);
-    table.SelectRow(0).SeparatorVertical(LIGHT);
-    table.SelectRow(0).Border(DOUBLE);
-
-    auto content = table.SelectRows(1, -1);
-    content.DecorateCellsAlternateRow(color(Color::Blue), 3, 0);
-    content.DecorateCellsAlternateRow(color(Color::Cyan), 3, 1);
-    content.DecorateCellsAlternateRow(color(Color::White), 3, 2);
-
-    auto document = table.Render();
-    auto screen = Screen::Create(Dimension::Full(), Dimension::Fit(document));
-    Render(screen, document);
-    screen.Print();
-    std::cout << screen.ResetPosition();
-    if (m_last_num_players > m_players.size()) {
-        std::cout << std::endl;
+void GameServer::assign_lobby(const std::string& name) {
+    if (!m_name.empty()) {
+        spdlog::error("server already runs lobby \"{}\", can't take \"{}\"", m_name, name);
+        return;
     }
-    m_last_num_players = m_players.size();;
+    spdlog::info("got lobby \"{}\" from the proxy", name);
+    m_name = name;
+    schedule_idle_shutdown();
+    register_in_matchmaking();
+    // proxy is needed only to get the lobby
+    enet_peer_disconnect(m_proxy, 0);
 }
 
-void GameServer::object_physics(GameObject& object, float dt) {
-    object.velocity -= object.velocity * 0.3f * dt;
-    if (object.position.x != object.position.x) {
-        spdlog::warn("object {} has nan in position :(", object.id);
+void GameServer::publish_status() {
+    if (m_status != nullptr) {
+        m_status->publish(m_players);
     }
-    object.position += object.velocity * dt;
 }
 
 void GameServer::update_physics(float dt) {
-    for (auto& object : m_game_objects) {
-        object_physics(object, dt);
-    }          
-    process_borders();
+    for (size_t i = 0; i < m_game_objects.size(); ++i) {
+        if (m_game_objects.x[i] != m_game_objects.x[i]) {
+            spdlog::warn("object {} has nan in position :(", m_game_objects.id[i]);
+        }
+    }
+    m_game_objects.integrate(dt, s_simulation_borders);
+    m_grid.update(m_game_objects);
 }
 
 
-Player GameServer::create_player(const ENetAddress& address, const std::string& name) {
-    auto id = generate_id();
+Player GameServer::create_player(const ENetAddress& address, std::string_view name) {
     Player player;
     player.name = name;
     player.address = address; 
-    player.id = id; 
+    player.id = SlotIndex::s_invalid; 
     player.ping = 0;
     return player;
 }
 
 void GameServer::send_ping() {
-    // send ping
+    // only players are listed, so the count is known once the peers are walked
     auto peers = get_peers();
-    OutByteStream ping_msg;
-    ping_msg << MessageType::ping << uint32_t(m_players.size());
+    m_ping_entries.clear();
     for (const auto& peer : peers) {
-        if (peer.address.port == 0 || peer.address.port == s_matchmaking_server_port) {
-            // don't know what it is. Enet implementation detail, I suppose
-            continue;
-        }
-        if (peer.state != ENET_PEER_STATE_CONNECTED) {
+        // matchmaking, the proxy of a warm server and players not registered yet have no player attached
+        if (peer.state != ENET_PEER_STATE_CONNECTED || attached_player(peer) == SlotIndex::s_invalid) {
             continue;
         }
         
-        auto player = get_player(peer.address);
-        if (player == m_players.end()) {
+        auto player = get_player(peer);
+        if (player == nullptr) {
             spdlog::warn("host on port {} is not a player!", peer.address.port);
             continue;
         }
-        ping_msg << player->id << peer.roundTripTime;
+        m_ping_entries.emplace_back(player->id, peer.roundTripTime);
         player->ping = peer.roundTripTime;
     }
-
-    broadcast_message<false>(ping_msg.get_span());
+    m_message.reset();
+    m_message << MessageType::ping << varint{uint32_t(m_ping_entries.size())};
+    for (auto [id, ping] : m_ping_entries) {
+        m_message << varint{id} << varint{ping};
+    }
+    broadcast_message<false>(m_message.get_span());
 }
 
 
 void GameServer::update_players() {
-    auto peers = get_peers();        
-    OutByteStream update_info;
-    update_info << MessageType::game_update;
-    write_objects(update_info);
+    auto sequence = m_snapshot_sequence++;
 
-    for (auto& peer : peers) {
-        if (peer.state != ENET_PEER_STATE_CONNECTED || peer.address.port == s_matchmaking_server_port) {
+    // every client gets only the objects around it,
+    // as a delta from the last snapshot it has acknowledged
+    for (auto& peer : get_peers()) {
+        if (peer.state != ENET_PEER_STATE_CONNECTED || attached_player(peer) == SlotIndex::s_invalid) {
             continue;
         }
-        auto player = get_player(peer.address);
-        if (player == m_players.end()) {
+        auto player = get_player(peer);
+        if (player == nullptr) {
             spdlog::error("can't find player at address {}:{}", peer.address.host, peer.address.port);
+            continue;
+        }
+        auto object = get_object_from_player(*player);
+        if (object == SlotIndex::s_invalid) {
+            continue;
         }
-        send_bytes<false>(update_info.get_span(), &peer);
+        auto& session = m_sessions.at(player->id);
+        session.interest.update(m_game_objects, m_grid, object);
+
+        auto& snapshot = session.history.push(sequence);
+        take_snapshot(snapshot, session.interest);
+        // looked up after push, so a baseline overwritten by it is not used
+        auto baseline = session.history.find(session.acked_snapshot);
+
+        m_message.reset();
+        m_message << MessageType::game_update;
+        write_snapshot(m_message, snapshot, baseline);
+        m_batcher.add<false>(&peer, m_message.get_span());
     }
+    // everything queued since the last tick goes out together with the updates
+    m_batcher.flush();
 }
@@ -3,13 +3,16 @@
 #include <algorithm>
 #include <iterator>
 #include <set>
-#include <map>
+#include <unordered_map>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <cstdint>
 #include <array>
 #include <chrono>
 #include <span>
 #include <iostream>
+#include <memory>
 
 #include <enet/enet.h>
 #include <spdlog/spdlog.h>
@@ -18,6 +21,12 @@
 #include "glm/geometric.hpp"
 #include "timed_task_manager.hpp"
 #include "base_server.hpp"
+#include "spatial_grid.hpp"
+#include "slot_index.hpp"
+#include "object_store.hpp"
+#include "snapshot.hpp"
+#include "interest.hpp"
+#include "message_batch.hpp"
 
 using namespace std::chrono_literals;
 
@@ -26,13 +35,34 @@ struct Robot {
     uint32_t object_id;
 };
 
+// older acknowledged snapshots can't be used as a baseline, full snapshot is sent instead
+inline constexpr size_t s_snapshot_history_size = 32;
+
+struct PlayerSession {
+    uint32_t object_id;
+    uint32_t acked_snapshot = s_no_snapshot;
+    InterestArea interest = {};
+    // snapshots differ between players, so each one has its own history
+    SnapshotHistory<s_snapshot_history_size> history = {};
+};
+
+class StatusDisplay;
+
 class GameServer: public BaseServer<GameServer> {
     using players_t = std::vector<Player>;
-    using objects_t = std::vector<GameObject>;
+    using objects_t = ObjectStore;
     using game_clock_t = std::chrono::steady_clock;
 
 public:
-    GameServer(ENetHost* host, const std::string& name, uint32_t id);
+    // status_period of zero disables the player table (headless mode).
+    // Non-zero proxy_port makes a warm server: it connects to matchmaking in advance
+    // and waits for the proxy on that port to assign it a lobby.
+    GameServer(
+            ENetHost* host, const std::string& name, uint32_t id,
+            std::chrono::milliseconds status_period = s_default_status_period,
+            uint16_t proxy_port = 0
+    );
+    ~GameServer();
 
     //void run();
     void on_start();
@@ -43,97 +73,153 @@ public:
     void process_disconnect(ENetEvent&);
 
 
-
-    static void object_physics(GameObject& object, float dt);
-
     static float speed_of_object(const GameObject& object) {
         return 5.0f / (object.radius + 1.0f);
     }
 
-    static void object_borders(GameObject& obj) {
-        if (obj.position.x + obj.radius > s_simulation_borders.x) {
-            obj.position.x = s_simulation_borders.x - obj.radius;
-        }
-        if (obj.position.x - obj.radius < 0) {
-            obj.position.x = obj.radius;
-        }
-        if (obj.position.y + obj.radius > s_simulation_borders.y) {
-            obj.position.y = s_simulation_borders.y - obj.radius;
-        }
-        if (obj.position.y - obj.radius < 0) {
-            obj.position.y = obj.radius;
-        }
-    }
-
     static constexpr std::chrono::milliseconds s_update_time = 60ms;
+    static constexpr std::chrono::milliseconds s_default_status_period = 200ms;
+    static constexpr ScheduleMode s_schedule_mode = ScheduleMode::event_driven;
 private:
-    size_t m_last_num_players = 0;
     std::string m_name;
     uint64_t m_id;
 
-    void update_screen();
+    void publish_status();
+
+    void register_in_matchmaking();
+
+    void assign_lobby(const std::string& name);
+
+    void schedule_idle_shutdown();
 
 
     void update_physics(float dt);
 
-    Player create_player(const ENetAddress& address, const std::string& name);
+    Player create_player(const ENetAddress& address, std::string_view name);
 
     GameObject create_game_object() {
         GameObject obj = {
             .position = vec2{0, 0},
             .velocity = vec2{0, 0},
             .radius = 1.0f,
-            .id = generate_obj_id()
+            .id = SlotIndex::s_invalid
         };
         random_teleport(obj);
         return obj;
     }
 
-    template<typename T>
-    players_t::iterator add_player(T&& player) {
-        m_players.push_back(std::forward<T>(player));
-        return m_players.end() - 1;
+    Player& add_player(Player player) {
+        player.id = m_player_index.insert(uint32_t(m_players.size()));
+        m_address_to_player[player.address] = player.id;
+        m_players.push_back(std::move(player));
+        return m_players.back();
+    }
+
+    void remove_player(uint32_t id) {
+        auto index = m_player_index.find(id);
+        if (index == SlotIndex::s_invalid) {
+            spdlog::error("trying to remove unknown player {}", id);
+            return;
+        }
+        m_address_to_player.erase(m_players[index].address);
+        if (index + 1 != m_players.size()) {
+            m_players[index] = std::move(m_players.back());
+            m_player_index.relocate(m_players[index].id, index);
+        }
+        m_players.pop_back();
+        m_player_index.erase(id);
+    }
+
+    Player* find_player(uint32_t id) {
+        auto index = m_player_index.find(id);
+        return index == SlotIndex::s_invalid ? nullptr : &m_players[index];
     }
 
-    players_t::iterator get_player(const ENetAddress& address) {
-        return std::find_if(m_players.begin(), m_players.end(), [&](const Player& player) { 
-                return player.address.host == address.host && player.address.port == address.port; 
-        } );
+    // Player id is stored right in the peer data pointer, nullptr means there is no player
+    static void attach_player(ENetPeer& peer, uint32_t id) {
+        peer.data = reinterpret_cast<void*>(uintptr_t(id) + 1);
+    }
+
+    static uint32_t attached_player(const ENetPeer& peer) {
+        if (peer.data == nullptr) {
+            return SlotIndex::s_invalid;
+        }
+        return uint32_t(reinterpret_cast<uintptr_t>(peer.data) - 1);
+    }
+
+    Player* get_player(const ENetPeer& peer) {
+        if (auto player = find_player(attached_player(peer))) {
+            return player;
+        }
+        auto id = m_address_to_player.find(peer.address);
+        return id == m_address_to_player.end() ? nullptr : find_player(id->second);
     }
 
     void broadcast_new_player(const Player& player) {
-        OutByteStream ostr;
-        ostr << MessageType::list_update << player;
-        return broadcast_message<true>(ostr.get_span());
+        m_message.reset();
+        m_message << MessageType::list_update << player;
+        broadcast_message<true>(m_message.get_span());
     }
 
+    // Goes into the batches of all players, they are sent at the end of the tick.
+    // A message too big for a batch is sent right away as one packet shared by all players.
     template<bool reliable>
     void broadcast_message(const std::span<std::byte>& message) {
-        auto peers = get_peers();        
+        auto is_player = [](const ENetPeer& peer) {
+            return peer.state == ENET_PEER_STATE_CONNECTED && attached_player(peer) != SlotIndex::s_invalid;
+        };
+        auto peers = get_peers();
+        auto fits = std::ranges::all_of(peers, [&](const ENetPeer& peer) {
+            return !is_player(peer) || MessageBatcher::fits_batch(peer, message.size());
+        });
         for (auto& peer : peers) {
-            if (peer.state != ENET_PEER_STATE_CONNECTED) {
+            if (!is_player(peer)) {
                 continue;
             }
-            send_bytes<reliable>(message, &peer);
+            if (fits) {
+                m_batcher.add<reliable>(&peer, message);
+            } else {
+                m_batcher.flush<reliable>(&peer);
+            }
+        }
+        if (!fits) {
+            send_to_peers<reliable>(create_packet<reliable>(message), peers, is_player);
         }
-    }
-
-    std::span<ENetPeer> get_peers() {
-        return {m_host->peers,  m_host->peerCount};
     }
 
     std::string generate_name(uint64_t id) {
         return s_nicknames[std::hash<uint64_t>{}(id) % s_nicknames.size()];      
     }
 
-    uint32_t generate_id() {
-        return m_next_player_id++;
+    uint32_t add_object(GameObject obj) {
+        obj.id = m_object_index.insert(uint32_t(m_game_objects.size()));
+        m_game_objects.push_back(obj);
+        return obj.id;
     }
 
-    uint32_t generate_obj_id() {
-        return m_next_object_id++;
+    void remove_object(uint32_t id) {
+        auto index = m_object_index.find(id);
+        if (index == SlotIndex::s_invalid) {
+            spdlog::error("trying to remove unknown object {}", id);
+            return;
+        }
+        if (index + 1 != m_game_objects.size()) {
+            m_game_objects.set(index, m_game_objects.get(m_game_objects.size() - 1));
+            m_object_index.relocate(m_game_objects.id[index], index);
+        }
+        m_game_objects.pop_back();
+        m_object_index.erase(id);
+        m_grid.invalidate();
     }
 
+    // Returns index of the object in m_game_objects or SlotIndex::s_invalid
+    uint32_t find_object(uint32_t id) const {
+        return m_object_index.find(id);
+    }
+
+    // Handles one message of a packet, clients may batch them
+    void process_message(ENetEvent& event, InByteStream& istr);
+
     void send_ping();
 
     void update_players();
@@ -149,62 +235,45 @@ private:
         obj.position = random_point();
     }
 
-    void write_objects(OutByteStream& ostr, uint32_t exclude = uint32_t(-1)) {
-        auto size = uint32_t(m_game_objects.size());
-        if (exclude != uint32_t(-1)) {
-            --size;
-        }
-        ostr << size;
-        for (const auto& object : m_game_objects) {
-            if (object.id == exclude) {
-                continue;
+    // Only objects from the area of interest get into the snapshot
+    void take_snapshot(ObjectsSnapshot& snapshot, const InterestArea& interest) const {
+        snapshot.objects.clear();
+        snapshot.objects.reserve(interest.ids().size());
+        for (auto id : interest.ids()) {
+            auto index = find_object(id);
+            if (index != SlotIndex::s_invalid) {
+                snapshot.objects.push_back(m_game_objects.get(index));
             }
-            ostr << object;
-        }
-    }
-
-    void process_borders() {
-        for (auto& obj : m_game_objects) {
-            object_borders(obj);
         }
     }
 
     void processs_collisions() {
-        for (size_t i = 0; i < m_game_objects.size(); ++i) {
-            for (size_t j = i + 1; j < m_game_objects.size(); ++j) {
-                auto& first = m_game_objects[i];
-                auto& second = m_game_objects[j];
-                if (glm::distance(first.position, second.position) < first.radius + second.radius) {
-                    auto& bigger = first.radius < second.radius ? second : first;
-                    auto& smaller = first.radius < second.radius ? first : second;
-                    
-                    smaller.radius = std::max(smaller.radius / 2.0f, 0.2f);
-                    bigger.radius = std::min(bigger.radius + smaller.radius, std::max(s_simulation_borders.x, s_simulation_borders.y) / 8.0f);
-                    random_teleport(smaller);
-                }
-            }
-        }
+        resolve_collisions(m_game_objects, m_grid, max_object_radius(s_simulation_borders), [this](GameObject& obj) {
+            random_teleport(obj);
+        });
     }
 
     void process_robots() {
         for (auto& robot : m_robots) {
-            auto obj = std::find_if(m_game_objects.begin(), m_game_objects.end(), [&](const auto& o){return o.id == robot.object_id;});
-            if (obj == m_game_objects.end()) {
+            auto index = find_object(robot.object_id);
+            if (index == SlotIndex::s_invalid) {
                 spdlog::error("robot without object (his obj id is {})", robot.object_id);
                 continue;
             }
+            auto obj = m_game_objects.get(index);
 
-            if (obj->radius > 4.0f || obj->radius < 0.3f) {
-                obj->radius = 0.9f;
-                random_teleport(*obj);
+            if (obj.radius > 4.0f || obj.radius < 0.3f) {
+                obj.radius = 0.9f;
+                random_teleport(obj);
             }
             
-            auto direction = glm::normalize(robot.current_goal - obj->position);
-            obj->velocity = direction * speed_of_object(*obj);
+            auto direction = glm::normalize(robot.current_goal - obj.position);
+            obj.velocity = direction * speed_of_object(obj);
 
-            if (glm::distance(obj->position, robot.current_goal) < obj->radius) {
+            if (glm::distance(obj.position, robot.current_goal) < obj.radius) {
                 robot.current_goal = random_point();
             }
+            m_game_objects.set(index, obj);
         }
     }
 
@@ -213,15 +282,13 @@ private:
         obj.radius = 0.9f;
         auto robot = Robot();
         robot.current_goal = random_point();
-        robot.object_id = obj.id;
-        m_game_objects.push_back(obj);
+        robot.object_id = add_object(obj);
         m_robots.push_back(robot);
     }
 
-    objects_t::iterator get_object_from_player(const Player& player) {
-        auto obj_id = m_player_to_object.at(player.id);
-        auto object = std::find_if(m_game_objects.begin(), m_game_objects.end(), [&](const auto& obj) {return obj.id == obj_id;});
-        if (object == m_game_objects.end()) {
+    uint32_t get_object_from_player(const Player& player) {
+        auto object = find_object(m_sessions.at(player.id).object_id);
+        if (object == SlotIndex::s_invalid) {
             spdlog::error("Cannot find object for player {}", player.id);
         }
         return object;
@@ -229,15 +296,26 @@ private:
 
 
     players_t m_players;
+    SlotIndex m_player_index;
+    std::unordered_map<PlayerAddress, uint32_t> m_address_to_player;
     objects_t m_game_objects;
-    std::map<uint32_t, uint32_t> m_player_to_object;
+    SlotIndex m_object_index;
+    SpatialGrid m_grid{s_simulation_borders};
+    std::unordered_map<uint32_t, PlayerSession> m_sessions;
     std::vector<Robot> m_robots;
-    uint32_t m_next_player_id = 0;
-    uint32_t m_next_object_id = 0;
+    uint32_t m_snapshot_sequence = 0;
+    // player id and round trip time, reused between pings
+    std::vector<std::pair<uint32_t, uint32_t>> m_ping_entries;
+    // messages are written here before they go into batches
+    OutByteStream m_message;
+    MessageBatcher m_batcher;
     typename game_clock_t::time_point m_start_time;   
     float m_dt = float(s_update_time.count()) / 1000.0f;
-    bool m_connected = false;
+    bool m_registered = false;
+    std::unique_ptr<StatusDisplay> m_status;
     ENetPeer* matchmaking = nullptr;
+    uint16_t m_proxy_port;
+    ENetPeer* m_proxy = nullptr;
 
     inline static const std::array s_nicknames = {
         "Rames Janor", "Nova", "Deckard Cain", "Dark Wanderer",
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "object_store.hpp"
+#include "spatial_grid.hpp"
+
+
+// Ids of objects a player should know about: everything around its own object
+// within a range proportional to the object radius, the same way the client view scales.
+// An object enters the area at s_enter_scale radii and leaves it only beyond
+// s_leave_scale radii, so objects moving along the boundary don't flicker.
+class InterestArea {
+public:
+    // client renders an area of 8 radii across the shorter side of the window
+    static constexpr float s_enter_scale = 8.0f;
+    static constexpr float s_leave_scale = 10.0f;
+
+    void update(const ObjectStore& objects, SpatialGrid& grid, uint32_t center_index) {
+        auto center = objects.position(center_index);
+        auto enter_range = objects.radius[center_index] * s_enter_scale;
+        auto leave_range = objects.radius[center_index] * s_leave_scale;
+        auto extent = vec2{leave_range, leave_range};
+
+        m_next_ids.clear();
+        m_next_ids.push_back(objects.id[center_index]);
+        grid.for_each_in_box(center - extent, center + extent, [&](uint32_t index) {
+            if (index >= objects.size()) {
+                // grid hasn't been updated after removal yet
+                return;
+            }
+            auto distance = glm::distance(center, objects.position(index)) - objects.radius[index];
+            if (distance < enter_range || (distance < leave_range && contains(objects.id[index]))) {
+                m_next_ids.push_back(objects.id[index]);
+            }
+        });
+        std::sort(m_next_ids.begin(), m_next_ids.end());
+        m_next_ids.erase(std::unique(m_next_ids.begin(), m_next_ids.end()), m_next_ids.end());
+        std::swap(m_ids, m_next_ids);
+    }
+
+    // Sorted ids of the objects in the area
+    const std::vector<uint32_t>& ids() const {
+        return m_ids;
+    }
+
+    bool contains(uint32_t id) const {
+        return std::binary_search(m_ids.begin(), m_ids.end(), id);
+    }
+
+private:
+    std::vector<uint32_t> m_ids;
+    std::vector<uint32_t> m_next_ids;
+};
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
 #include <string>
 #include <vector>
 
@@ -40,32 +43,77 @@ struct Lobby {
     uint16_t min_mmr;
     uint16_t avg_mmr;
     LobbyState state;
+
+    SERIALIZED_FIELDS(name, description, mods, players, max_players, max_mmr, min_mmr, avg_mmr, state)
 };
 
 using client_lobby_t = Lobby<LobbyPlayer>;
 using server_lobby_t = Lobby<InnerLobbyPlayer>;
 
-template<typename player_t>
-inline OutByteStream& operator<<(OutByteStream& ostr, const Lobby<player_t>& lobby) {
-    ostr << lobby.name << lobby.description << lobby.mods << lobby.players;
-    /*for (const auto& mod : lobby.mods) {
-        ostr << mod;
-    }*/
-    return ostr << lobby.max_players 
-        << lobby.max_mmr << lobby.min_mmr 
-        << lobby.avg_mmr << lobby.state;
+inline LobbyPlayer to_lobby_player(const InnerLobbyPlayer& player) {
+    return {player.name, player.peer->address, player.ready};
 }
 
-template<typename player_t>
-inline InByteStream& operator>>(InByteStream& istr, Lobby<player_t>& lobby) {
-    istr >> lobby.name >> lobby.description >> lobby.mods >> lobby.players;
+inline client_lobby_t to_client_lobby(const server_lobby_t& lobby) {
+    client_lobby_t client_lobby = {
+        .name = lobby.name,
+        .description = lobby.description,
+        .mods = lobby.mods,
+        .players = {},
+        .max_players = lobby.max_players,
+        .max_mmr = lobby.max_mmr,
+        .min_mmr = lobby.min_mmr,
+        .avg_mmr = lobby.avg_mmr,
+        .state = lobby.state
+    };
+    client_lobby.players.reserve(lobby.players.size());
+    std::ranges::transform(lobby.players, std::back_inserter(client_lobby.players), to_lobby_player);
+    return client_lobby;
+}
 
-    /*size_t mods_size;
-    istr >> mods_size;
-    lobby.mods.reserve(mods_size);
-    for (size_t i = 0; i < mods_size; ++i) {
-        lobby.mods.push_back(istr.get<Mod>());
-    }*/
+// Lobby list is versioned: full list comes with its version, and every change
+// after it comes as a lobby_diff with the next version.
+// Versions and indices are varints. Changes other than created are followed by the lobby index:
+//   created         client_lobby_t
+//   player_joined   index, LobbyPlayer
+//   player_left     index, player index (the last player takes its place)
+//   player_changed  index, player index, LobbyPlayer
+//   state_changed   index, LobbyState
+enum class LobbyChange : uint8_t {
+    created, player_joined, player_left, player_changed, state_changed
+};
 
-    return istr >> lobby.max_players >> lobby.max_mmr >> lobby.min_mmr >> lobby.avg_mmr >> lobby.state;
+inline constexpr uint32_t s_no_lobby_version = uint32_t(-1);
+
+// Returns false if the change doesn't fit the list, it has to be requested again then
+inline bool apply_lobby_change(std::vector<client_lobby_t>& lobbies, InByteStream& istr) {
+    auto change = istr.get<LobbyChange>();
+    if (change == LobbyChange::created) {
+        lobbies.push_back(istr.get<client_lobby_t>());
+        return true;
+    }
+    auto index = istr.get<varint<uint32_t>>().value;
+    if (index >= lobbies.size()) {
+        return false;
+    }
+    auto& lobby = lobbies[index];
+    if (change == LobbyChange::player_joined) {
+        lobby.players.push_back(istr.get<LobbyPlayer>());
+    } else if (change == LobbyChange::player_left || change == LobbyChange::player_changed) {
+        auto player = istr.get<varint<uint32_t>>().value;
+        if (player >= lobby.players.size()) {
+            return false;
+        }
+        if (change == LobbyChange::player_left) {
+            lobby.players[player] = std::move(lobby.players.back());
+            lobby.players.pop_back();
+        } else {
+            istr >> lobby.players[player];
+        }
+    } else if (change == LobbyChange::state_changed) {
+        istr >> lobby.state;
+    } else {
+        return false;
+    }
+    return true;
 }
@@ -1,16 +1,43 @@
-#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include <spawn.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include <enet/enet.h>
 
 #include "base_server.hpp"
 #include "lobby.hpp"
+#include "room_host.hpp"
+#include "server_provider.hpp"
+
 
+enum class LaunchMode {
+    // game servers are rooms on the worker threads of this process
+    rooms,
+    // every game server is a separate server6 process,
+    // a few of them are started in advance and wait for a lobby
+    processes
+};
 
 class ProxyServer: public BaseServer<ProxyServer> {
 public:
-    ProxyServer(ENetHost* host): BaseServer(host) {}
+    ProxyServer(ENetHost* host, LaunchMode mode): BaseServer(host) {
+        if (mode == LaunchMode::rooms) {
+            m_rooms = std::make_unique<RoomHost>();
+        }
+    }
 
     static constexpr std::chrono::milliseconds s_update_time = 10ms;
+    static constexpr ScheduleMode s_schedule_mode = ScheduleMode::event_driven;
 public:
     void update() {
         if (matchmaking == nullptr) {
@@ -25,10 +52,22 @@ public:
             msg << MessageType::register_provider;
             if (send_bytes<true>(msg.get_span(), matchmaking) == 0) {
                 registered = true;
+                send_load();
             } 
         }
     }
-    void on_start() {}
+    void on_start() {
+        m_task_manager.add_task([this] { send_load(); return true; }, s_load_report_period);
+        if (m_rooms != nullptr) {
+            return;
+        }
+        start_warm_servers();
+        m_task_manager.add_task([this] {
+            reap_server_processes();
+            start_warm_servers();
+            return true;
+        }, 1s);
+    }
     void on_finish() {}
     void process_new_connection(ENetEvent&) { }
 
@@ -38,46 +77,140 @@ public:
         istr >> type;
         if (type == MessageType::lobby_start) {
             auto name = istr.get<std::string>();
-            auto num_mods = istr.get<size_t>();
-            std::vector<Mod> mods;
-            mods.reserve(num_mods);
-            for (size_t i = 0; i < num_mods; ++i) {
-                mods.push_back(istr.get<Mod>());
+            auto mods = istr.get<std::vector<Mod>>();
+            if (m_rooms != nullptr) {
+                m_rooms->create_room(name);
+            } else if (!m_idle_servers.empty()) {
+                auto server = m_idle_servers.front();
+                m_idle_servers.pop_front();
+                OutByteStream msg;
+                msg << MessageType::assign_lobby << name;
+                send_bytes<true>(msg.get_span(), server);
+                spdlog::info("lobby \"{}\" is given to a warm server on port {}", name, server->address.port);
+                start_warm_servers();
+            } else {
+                launch_server_process(mods, name);
             }
-            launch_server_process(mods, name);
+        } else if (type == MessageType::warm_server_ready) {
+            auto pid = istr.get<int32_t>();
+            m_starting_servers.erase(pid);
+            m_idle_servers.push_back(event.peer);
+            spdlog::info("warm server {} on port {} is ready", pid, event.peer->address.port);
         }
     }
 
     void process_disconnect(ENetEvent& event) {
-        if (event.peer->address == matchmaking->address) {
+        if (event.peer == matchmaking) {
             matchmaking = nullptr;
             registered = false;
+            return;
         }
+        std::erase(m_idle_servers, event.peer);
     }
 
 private:
     ENetPeer* matchmaking = nullptr;
-    std::vector<std::jthread> server_threads;
-    uint16_t next_port;
     bool registered = false;
+    std::unique_ptr<RoomHost> m_rooms;
+    // warm servers connected to the proxy and waiting for a lobby
+    std::deque<ENetPeer*> m_idle_servers;
+    // pids of warm servers that haven't connected yet
+    std::unordered_set<pid_t> m_starting_servers;
+    // pids of all server processes that haven't exited yet
+    std::unordered_set<pid_t> m_server_processes;
 
     static constexpr const char* s_server_executable = "./build/hw6/server6";
+    static constexpr size_t s_warm_servers = 2;
+    static constexpr uint32_t s_rooms_per_core = 16;
+    static constexpr uint32_t s_processes_per_core = 2;
+    // has to be well below ServerProvider::s_report_timeout
+    static constexpr std::chrono::milliseconds s_load_report_period = 1s;
+
+    void send_load() {
+        if (!registered) {
+            return;
+        }
+        auto num_cores = std::max(std::thread::hardware_concurrency(), 1u);
+        ProviderLoad load;
+        if (m_rooms != nullptr) {
+            load.running_servers = uint32_t(m_rooms->num_rooms());
+            load.max_servers = num_cores * s_rooms_per_core;
+        } else {
+            auto not_running = m_starting_servers.size() + m_idle_servers.size();
+            load.running_servers = uint32_t(m_server_processes.size() - std::min(not_running, m_server_processes.size()));
+            load.max_servers = num_cores * s_processes_per_core;
+            load.warm_servers = uint32_t(m_idle_servers.size());
+        }
+        double load_average;
+        if (getloadavg(&load_average, 1) == 1) {
+            load.cpu_load = float(load_average / num_cores);
+        }
+        OutByteStream msg;
+        msg << MessageType::provider_load << load;
+        send_bytes<false>(msg.get_span(), matchmaking);
+    }
 
+    // Servers bind any free port (0) and report it to matchmaking themselves
     void launch_server_process(const std::vector<Mod>& mods, const std::string& name) {
-        server_threads.emplace_back([=]{
-            std::stringstream command;
-            command << s_server_executable << ' ' << next_port++ << ' ' << '"' <<  name << '"';
-            for (const auto& mod : mods) {
-                command << ' ' << mod.to_str();
+        std::vector<std::string> args = {"0", fmt::format("--name={}", name), "--headless"};
+        for (const auto& mod : mods) {
+            if (auto mod_name = mod.to_str(); !mod_name.empty()) {
+                args.push_back(std::move(mod_name));
             }
-            spdlog::info("creating server with command {}", command.str());
-            std::system(command.str().c_str());        
-        });
+        }
+        auto pid = spawn_server(std::move(args));
+        if (pid > 0) {
+            m_server_processes.insert(pid);
+        }
+    }
+
+    void start_warm_servers() {
+        while (m_idle_servers.size() + m_starting_servers.size() < s_warm_servers) {
+            auto pid = spawn_server({"0", "--headless", fmt::format("--warm={}", m_host->address.port)});
+            if (pid < 0) {
+                return;
+            }
+            m_starting_servers.insert(pid);
+            m_server_processes.insert(pid);
+        }
+    }
+
+    void reap_server_processes() {
+        pid_t pid;
+        int status;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            m_server_processes.erase(pid);
+            if (m_starting_servers.erase(pid) != 0) {
+                spdlog::warn("warm server {} exited before it was ready", pid);
+            }
+        }
+    }
+
+    static pid_t spawn_server(std::vector<std::string> args) {
+        args.insert(args.begin(), s_server_executable);
+        std::vector<char*> argv;
+        argv.reserve(args.size() + 1);
+        for (auto& arg : args) {
+            argv.push_back(arg.data());
+        }
+        argv.push_back(nullptr);
+
+        pid_t pid;
+        if (int error = posix_spawn(&pid, s_server_executable, nullptr, nullptr, argv.data(), environ); error != 0) {
+            spdlog::error("could not start {}: {}", s_server_executable, std::strerror(error));
+            return -1;
+        }
+        spdlog::info("started server process {}", pid);
+        return pid;
     }
 
 };
 
-int main() {
-    ProxyServer proxy(create_host(7'000));
+int main(int argc, char** argv) {
+    auto mode = LaunchMode::rooms;
+    if (argc > 1 && std::string_view(argv[1]) == "--processes") {
+        mode = LaunchMode::processes;
+    }
+    ProxyServer proxy(create_host(7'000), mode);
     proxy.run();
 }
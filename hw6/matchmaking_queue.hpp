@@ -0,0 +1,195 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+// Automatic matchmaking: queued players are kept in buckets of similar MMR.
+// Every player accepts others within an MMR window that widens the longer they wait,
+// two players can be matched only if both windows allow it.
+// Players waiting the longest are matched first, with the closest buckets preferred.
+template<typename Key, typename queue_clock_t>
+class MatchQueue {
+    using time_point = typename queue_clock_t::time_point;
+
+    struct Ticket {
+        uint16_t mmr;
+        time_point enqueued;
+        // position inside its bucket
+        uint32_t bucket_index;
+        uint64_t order;
+    };
+
+public:
+    static constexpr uint16_t s_bucket_width = 25;
+    static constexpr uint16_t s_initial_window = 50;
+    // window grows by this much every second of waiting
+    static constexpr uint16_t s_window_growth = 25;
+    static constexpr uint16_t s_max_window = 1000;
+
+    struct Match {
+        std::vector<Key> players;
+        uint16_t min_mmr;
+        uint16_t max_mmr;
+        uint16_t avg_mmr;
+        // of the player who waited the longest
+        typename queue_clock_t::duration max_wait;
+    };
+
+    explicit MatchQueue(size_t lobby_size): m_lobby_size(std::max(lobby_size, size_t(1))) {}
+
+    static uint16_t window(typename queue_clock_t::duration wait) {
+        auto seconds = std::chrono::duration_cast<std::chrono::duration<float>>(wait).count();
+        auto growth = std::max(seconds, 0.0f) * float(s_window_growth);
+        return uint16_t(std::min(float(s_initial_window) + growth, float(s_max_window)));
+    }
+
+    // Returns false if the player is queued already
+    bool enqueue(Key key, uint16_t mmr, time_point now) {
+        auto [ticket, inserted] = m_tickets.try_emplace(key);
+        if (!inserted) {
+            return false;
+        }
+        auto& bucket = m_buckets[mmr / s_bucket_width];
+        ticket->second = {mmr, now, uint32_t(bucket.size()), m_next_order};
+        bucket.push_back(key);
+        m_arrivals.push_back({key, m_next_order++});
+        return true;
+    }
+
+    bool cancel(Key key) {
+        auto ticket = m_tickets.find(key);
+        if (ticket == m_tickets.end()) {
+            return false;
+        }
+        remove(ticket);
+        return true;
+    }
+
+    bool contains(Key key) const {
+        return m_tickets.contains(key);
+    }
+
+    size_t size() const {
+        return m_tickets.size();
+    }
+
+    // Forms as many lobbies as the windows allow, calls on_match(Match&&) for each of them
+    template<typename F>
+    size_t form_matches(time_point now, F&& on_match) {
+        size_t formed = 0;
+        std::vector<Key> candidates;
+        candidates.reserve(m_lobby_size);
+        std::vector<Range> ranges;
+        ranges.reserve(m_lobby_size);
+        for (size_t i = 0; i < m_arrivals.size() && m_tickets.size() >= m_lobby_size; ++i) {
+            auto [key, order] = m_arrivals[i];
+            auto anchor = m_tickets.find(key);
+            if (anchor == m_tickets.end() || anchor->second.order != order) {
+                continue;
+            }
+            candidates.clear();
+            candidates.push_back(key);
+            collect_candidates(anchor->second, now, candidates, ranges);
+            if (candidates.size() < m_lobby_size) {
+                continue;
+            }
+            on_match(make_match(candidates, now));
+            ++formed;
+        }
+        // matched and cancelled players stay in the arrival order until here
+        std::erase_if(m_arrivals, [this](const auto& arrival) {
+            auto ticket = m_tickets.find(arrival.first);
+            return ticket == m_tickets.end() || ticket->second.order != arrival.second;
+        });
+        return formed;
+    }
+
+private:
+    // MMR a collected player accepts
+    struct Range {
+        uint16_t mmr;
+        uint16_t window;
+    };
+
+    static constexpr size_t s_num_buckets = (size_t(UINT16_MAX) + 1 + s_bucket_width - 1) / s_bucket_width;
+
+    size_t m_lobby_size;
+    std::unordered_map<Key, Ticket> m_tickets;
+    std::vector<std::vector<Key>> m_buckets = std::vector<std::vector<Key>>(s_num_buckets);
+    std::deque<std::pair<Key, uint64_t>> m_arrivals;
+    uint64_t m_next_order = 0;
+
+    // Walks buckets outwards from the anchor's one until the lobby is full or the window is passed.
+    // A candidate is taken only if it and every player collected before accept each other.
+    void collect_candidates(const Ticket& anchor, time_point now, std::vector<Key>& candidates, std::vector<Range>& ranges) const {
+        auto anchor_window = window(now - anchor.enqueued);
+        ranges.clear();
+        ranges.push_back({anchor.mmr, anchor_window});
+        int low = std::max(int(anchor.mmr) - int(anchor_window), 0) / s_bucket_width;
+        int high = std::min(int(anchor.mmr) + int(anchor_window), int(UINT16_MAX)) / s_bucket_width;
+        int center = anchor.mmr / s_bucket_width;
+        // returns true once the lobby is full
+        auto scan = [&](int bucket) {
+            for (const auto& key : m_buckets[size_t(bucket)]) {
+                const auto& ticket = m_tickets.at(key);
+                if (ticket.order == anchor.order) {
+                    continue;
+                }
+                auto ticket_window = window(now - ticket.enqueued);
+                auto accepted = std::all_of(ranges.begin(), ranges.end(), [&](const Range& range) {
+                    auto difference = std::abs(int(ticket.mmr) - int(range.mmr));
+                    return difference <= int(range.window) && difference <= int(ticket_window);
+                });
+                if (accepted) {
+                    candidates.push_back(key);
+                    ranges.push_back({ticket.mmr, ticket_window});
+                    if (candidates.size() == m_lobby_size) {
+                        return true;
+                    }
+                }
+            }
+            return false;
+        };
+        if (scan(center)) {
+            return;
+        }
+        for (int distance = 1; center - distance >= low || center + distance <= high; ++distance) {
+            if ((center - distance >= low && scan(center - distance)) || (center + distance <= high && scan(center + distance))) {
+                return;
+            }
+        }
+    }
+
+    Match make_match(const std::vector<Key>& players, time_point now) {
+        Match match = {players, UINT16_MAX, 0, 0, {}};
+        uint32_t mmr_sum = 0;
+        for (const auto& key : players) {
+            auto ticket = m_tickets.find(key);
+            match.min_mmr = std::min(match.min_mmr, ticket->second.mmr);
+            match.max_mmr = std::max(match.max_mmr, ticket->second.mmr);
+            match.max_wait = std::max(match.max_wait, now - ticket->second.enqueued);
+            mmr_sum += ticket->second.mmr;
+            remove(ticket);
+        }
+        match.avg_mmr = uint16_t(mmr_sum / players.size());
+        return match;
+    }
+
+    void remove(typename std::unordered_map<Key, Ticket>::iterator ticket) {
+        auto& bucket = m_buckets[ticket->second.mmr / s_bucket_width];
+        auto index = ticket->second.bucket_index;
+        if (index + 1 != bucket.size()) {
+            bucket[index] = std::move(bucket.back());
+            m_tickets.at(bucket[index]).bucket_index = index;
+        }
+        bucket.pop_back();
+        m_tickets.erase(ticket);
+    }
+};
@@ -20,6 +20,10 @@ void MatchMakingServer::process_data(ENetEvent& event) {
     istr >> type;
     if (type == MessageType::lobby_list_update) {
         send_lobby_list(event.peer);
+    } else if (type == MessageType::lobby_subscribe) {
+        // sent once and again on a version gap, either way the client needs the full list
+        m_lobby_subscribers.insert(event.peer);
+        send_lobby_list(event.peer);
     } else if (type == MessageType::lobby_create) {
         auto client_lobby = istr.get<client_lobby_t>();
         auto new_lobby = server_lobby_t {
@@ -33,16 +37,20 @@ void MatchMakingServer::process_data(ENetEvent& event) {
             .avg_mmr = client_lobby.avg_mmr,
             .state = client_lobby.state
         };
-        if (std::ranges::find_if(m_lobbies, [&](const auto& lobby) {return lobby.name == new_lobby.name;}) != m_lobbies.end()) {
+        if (find_lobby(new_lobby.name) != nullptr) {
             spdlog::warn("failed to create lobby with name {}, as this name is already taken", new_lobby.name);
             return;
         }
         spdlog::info("creating lobby {}", new_lobby.name);
+        m_lobby_by_name.emplace(new_lobby.name, uint32_t(m_lobbies.size()));
         m_lobbies.push_back(std::move(new_lobby));
         spdlog::info("created new lobby with name: \"{}\"", m_lobbies.back().name);
+        publish_lobby_change(LobbyChange::created, [this](OutByteStream& msg) {
+            msg << to_client_lobby(m_lobbies.back());
+        });
     } else if (type == MessageType::lobby_join) {
-        auto index = istr.get<size_t>();
-        if (index > m_lobbies.size()) {
+        auto index = istr.get<varint<size_t>>().value;
+        if (index >= m_lobbies.size()) {
             return;
         }
         if (m_lobbies[index].max_players == m_lobbies[index].players.size()) {
@@ -51,18 +59,33 @@ void MatchMakingServer::process_data(ENetEvent& event) {
         if (m_lobbies[index].state == LobbyState::playing) {
             return;
         }
+        if (m_player_slots.contains(event.peer)) {
+            spdlog::warn("player on port {} is already in a lobby", event.peer->address.port);
+            return;
+        }
         spdlog::info("connecting player to the lobby {}", index);
         OutByteStream msg;
-        msg << MessageType::lobby_join << index;
+        msg << MessageType::lobby_join << varint{index};
         send_bytes<true>(msg.get_span(), event.peer);
         m_lobbies[index].players.emplace_back(istr.get<std::string>(), event.peer, false);
+        m_player_slots[event.peer] = {uint32_t(index), uint32_t(m_lobbies[index].players.size() - 1)};
         spdlog::info("now lobby has {} players", m_lobbies[index].players.size());
+        publish_lobby_change(LobbyChange::player_joined, [&](OutByteStream& msg) {
+            msg << varint{uint32_t(index)} << to_lobby_player(m_lobbies[index].players.back());
+        });
     } else if (type == MessageType::lobby_start) {
-        auto index = istr.get<size_t>();
-        start_lobby(m_lobbies[index]); 
+        auto index = istr.get<varint<size_t>>().value;
+        if (index < m_lobbies.size()) {
+            start_lobby(m_lobbies[index]); 
+        }
     } else if (type == MessageType::register_provider) {
         spdlog::info("registered new server provider on port {}", event.peer->address.port);
         m_providers.emplace_back(event.peer);
+    } else if (type == MessageType::provider_load) {
+        auto provider = std::ranges::find(m_providers, event.peer, &ServerProvider::peer);
+        if (provider != m_providers.end()) {
+            provider->update_load(istr.get<ProviderLoad>());
+        }
     } else if (type == MessageType::server_ready) {
         auto lobby_name = istr.get<std::string>();
         spdlog::info("server for lobby \"{}\" is ready", lobby_name);
@@ -73,28 +96,43 @@ void MatchMakingServer::process_data(ENetEvent& event) {
             spdlog::info("Pending games: {}", debug.str());
             return;
         }
-        GameServerInfo info;
-        istr >> info.address.host >> info.address.port >> info.id;
-        auto lobby = std::ranges::find_if(m_lobbies, [&lobby_name](const server_lobby_t& l) {return l.name == lobby_name;});
-        if (lobby == m_lobbies.end()) {
+        auto info = istr.get<GameServerInfo>();
+        auto lobby = find_lobby(lobby_name);
+        if (lobby == nullptr) {
             throw std::runtime_error("can't find lobby to launch the game");
         }
-        launch_lobby(*lobby, info);
+        std::chrono::milliseconds server_wait = 0ms;
+        if (auto requested = m_server_requested.find(lobby_name); requested != m_server_requested.end()) {
+            server_wait = std::chrono::duration_cast<std::chrono::milliseconds>(game_clock_t::now() - requested->second);
+            spdlog::info("lobby \"{}\" got its server in {} ms", lobby_name, server_wait.count());
+            m_server_requested.erase(requested);
+        }
+        launch_lobby(*lobby, info, server_wait);
     } else if (type == MessageType::set_name) {
         auto name = istr.get<std::string>();
-        for (auto& lobby : m_lobbies) {
-            auto it = std::ranges::find_if(lobby.players, [&event](const auto& player) {return player.peer->address == event.peer->address;});  
-            if (it != lobby.players.end()) {
-                it->name = name;
-            }
+        if (auto slot = m_player_slots.find(event.peer); slot != m_player_slots.end()) {
+            m_lobbies[slot->second.lobby].players[slot->second.player].name = name;
+            publish_player_change(slot->second);
+        }
+    } else if (type == MessageType::queue_join) {
+        auto name = istr.get<std::string>();
+        auto mmr = istr.get<uint16_t>();
+        if (m_player_slots.contains(event.peer) || !m_queue.enqueue(event.peer, mmr, game_clock_t::now())) {
+            spdlog::warn("player on port {} can't be queued, as it is in a lobby or queued already", event.peer->address.port);
+            return;
         }
+        spdlog::info("player {} queued with mmr {}, {} in queue", name, mmr, m_queue.size());
+        m_queued_names[event.peer] = std::move(name);
+    } else if (type == MessageType::queue_leave) {
+        m_queue.cancel(event.peer);
+        m_queued_names.erase(event.peer);
     } else if (type == MessageType::player_ready) {
-        for (auto& lobby : m_lobbies) {
-            auto it = std::ranges::find_if(lobby.players, [&event](const auto& player) {return player.peer->address == event.peer->address;});  
-            if (it != lobby.players.end()) {
-                it->ready = !it->ready;
-                spdlog::info("changing ready for player {} in lobby {}, now {}", it->name, lobby.name, it->ready);
-            }
+        if (auto slot = m_player_slots.find(event.peer); slot != m_player_slots.end()) {
+            auto& lobby = m_lobbies[slot->second.lobby];
+            auto& player = lobby.players[slot->second.player];
+            player.ready = !player.ready;
+            spdlog::info("changing ready for player {} in lobby {}, now {}", player.name, lobby.name, player.ready);
+            publish_player_change(slot->second);
         }
     }
 }
@@ -102,69 +140,158 @@ void MatchMakingServer::process_data(ENetEvent& event) {
 
 void MatchMakingServer::process_disconnect(ENetEvent& event) {
     spdlog::info("client disconnected (port: {})", event.peer->address.port);
-    for (auto& lobby : m_lobbies) {
-        auto it = std::ranges::find_if(lobby.players, [&event](const auto& player) {return player.peer->address == event.peer->address;});  
-        if (it != lobby.players.end()) {
-            lobby.players.erase(it);
-        }
+    std::erase_if(m_providers, [&event](const ServerProvider& provider) { return provider.peer() == event.peer; });
+    m_lobby_subscribers.erase(event.peer);
+    m_queue.cancel(event.peer);
+    m_queued_names.erase(event.peer);
+    m_outbox.discard(event.peer);
+    remove_from_lobby(event.peer);
+}
+
+// Matched players get a lobby of their own which is started right away
+void MatchMakingServer::create_queue_lobby(match_queue_t::Match&& match) {
+    auto name = fmt::format("queue #{}", m_queue_lobbies++);
+    while (find_lobby(name) != nullptr) {
+        name = fmt::format("queue #{}", m_queue_lobbies++);
+    }
+    auto index = uint32_t(m_lobbies.size());
+    server_lobby_t lobby = {
+        .name = name,
+        .description = fmt::format("mmr {}-{}", match.min_mmr, match.max_mmr),
+        .mods = {},
+        .players = {},
+        .max_players = uint8_t(match.players.size()),
+        .max_mmr = match.max_mmr,
+        .min_mmr = match.min_mmr,
+        .avg_mmr = match.avg_mmr,
+        .state = LobbyState::waiting
+    };
+    lobby.players.reserve(match.players.size());
+    for (auto* peer : match.players) {
+        auto queued_name = m_queued_names.extract(peer);
+        m_player_slots[peer] = {index, uint32_t(lobby.players.size())};
+        lobby.players.emplace_back(std::move(queued_name.mapped()), peer, true);
     }
+    m_lobby_by_name.emplace(name, index);
+    m_lobbies.push_back(std::move(lobby));
+    spdlog::info("formed lobby \"{}\" from the queue, mmr {}-{}, waited {} ms", name, match.min_mmr, match.max_mmr,
+            std::chrono::duration_cast<std::chrono::milliseconds>(match.max_wait).count());
+    publish_lobby_change(LobbyChange::created, [this](OutByteStream& msg) {
+        msg << to_client_lobby(m_lobbies.back());
+    });
+    OutByteStream msg;
+    msg << MessageType::lobby_join << varint{size_t(index)};
+    for (auto* peer : match.players) {
+        send_bytes<true>(msg.get_span(), peer);
+    }
+    start_lobby(m_lobbies.back());
+}
+
+// Last player of the lobby takes the place of the removed one
+void MatchMakingServer::remove_from_lobby(const ENetPeer* peer) {
+    auto slot = m_player_slots.find(peer);
+    if (slot == m_player_slots.end()) {
+        return;
+    }
+    auto [lobby_index, player_index] = slot->second;
+    m_player_slots.erase(slot);
+    auto& players = m_lobbies[lobby_index].players;
+    if (player_index + 1 != players.size()) {
+        players[player_index] = std::move(players.back());
+        m_player_slots[players[player_index].peer].player = player_index;
+    }
+    players.pop_back();
+    publish_lobby_change(LobbyChange::player_left, [&](OutByteStream& msg) {
+        msg << varint{lobby_index} << varint{player_index};
+    });
+}
+
+server_lobby_t* MatchMakingServer::find_lobby(const std::string& name) {
+    auto index = m_lobby_by_name.find(name);
+    return index == m_lobby_by_name.end() ? nullptr : &m_lobbies[index->second];
 }
 
 void MatchMakingServer::send_lobby_list(ENetPeer* to) {
-    OutByteStream ostr;
-    ostr << MessageType::lobby_list_update << m_lobbies.size();
+    auto ostr = acquire_packet_stream();
+    ostr << MessageType::lobby_list_update << varint{m_lobby_version} << varint{m_lobbies.size()};
     for (const auto& lobby : m_lobbies) {
-        client_lobby_t client_lobby = {
-            .name = lobby.name,
-            .description = lobby.description,
-            .mods = lobby.mods,
-            .players = {},
-            .max_players = lobby.max_players,
-            .max_mmr = lobby.max_mmr,
-            .min_mmr = lobby.min_mmr,
-            .avg_mmr = lobby.avg_mmr,
-            .state = lobby.state
-        };
-        client_lobby.players.reserve(lobby.players.size());
-        std::ranges::transform(lobby.players, std::back_inserter(client_lobby.players), [](const InnerLobbyPlayer& server_player) -> LobbyPlayer {
-            return {server_player.name, server_player.peer->address, server_player.ready};
-        });
-        ostr << client_lobby;
+        ostr << to_client_lobby(lobby);
     } 
 
-    send_bytes<false>(ostr.get_span(), to);
+    send_stream<true>(std::move(ostr), to);
 }
 
+void MatchMakingServer::publish_player_change(LobbySlot slot) {
+    publish_lobby_change(LobbyChange::player_changed, [&](OutByteStream& msg) {
+        msg << varint{slot.lobby} << varint{slot.player} << to_lobby_player(m_lobbies[slot.lobby].players[slot.player]);
+    });
+}
+
+// The least loaded provider is asked right away. If no server is ready in s_hedge_delay,
+// the next one is asked as well, the first server to come is used.
 void MatchMakingServer::start_lobby(server_lobby_t& lobby) {
     spdlog::info("starting loby {}", lobby.name);
     m_pending_games.insert(lobby.name);
-    m_task_manager.add_task([this, provider = m_providers.begin(), lobby]() mutable -> bool {
-        spdlog::info("attempt {} to create a server for lobby {}", provider - m_providers.begin(), lobby.name);
-
-        if (m_pending_games.contains(lobby.name)) {
-            if (provider == m_providers.end()) {
-                //throw std::runtime_error("could not create game server");
-                return false;
-            }
-
-            provider->request_server(lobby.mods, lobby.name);
-            ++provider;
-            return true;
-        } else {
+    m_server_requested[lobby.name] = game_clock_t::now();
+    std::vector<ENetPeer*> asked;
+    request_server(lobby.name, lobby.mods, asked);
+    m_task_manager.add_task([this, name = lobby.name, mods = lobby.mods, asked]() mutable -> bool {
+        if (!m_pending_games.contains(name)) {
+            return false;
+        }
+        auto requested = m_server_requested.find(name);
+        if (requested != m_server_requested.end() && game_clock_t::now() - requested->second > s_server_request_timeout) {
+            // lobby is still ready, so it will be started again
+            spdlog::error("no server for lobby {} in {} ms, retrying", name, s_server_request_timeout.count());
+            m_pending_games.erase(name);
+            m_server_requested.erase(requested);
             return false;
         }
-    }, 5s, 0ms);
+        request_server(name, mods, asked);
+        return true;
+    }, s_hedge_delay);
 }
 
-void MatchMakingServer::launch_lobby(server_lobby_t& lobby, const GameServerInfo& server) {
+// Asks the least loaded available provider which hasn't been asked for this lobby yet
+bool MatchMakingServer::request_server(const std::string& lobby_name, const std::vector<Mod>& mods, std::vector<ENetPeer*>& asked) {
+    auto now = game_clock_t::now();
+    ServerProvider* best = nullptr;
+    for (auto& provider : m_providers) {
+        if (!provider.available(now) || std::ranges::find(asked, provider.peer()) != asked.end()) {
+            continue;
+        }
+        if (best == nullptr || provider.load() < best->load()) {
+            best = &provider;
+        }
+    }
+    if (best == nullptr) {
+        spdlog::warn("no available server providers for lobby {}", lobby_name);
+        return false;
+    }
+    spdlog::info("attempt {} to create a server for lobby {}", asked.size() + 1, lobby_name);
+    best->request_server(mods, lobby_name);
+    asked.push_back(best->peer());
+    return true;
+}
+
+// Clients get the time the lobby waited for its server, so they can tell the whole start latency
+void MatchMakingServer::launch_lobby(server_lobby_t& lobby, const GameServerInfo& server, std::chrono::milliseconds server_wait) {
+    auto lobby_index = uint32_t(&lobby - m_lobbies.data());
     lobby.state = LobbyState::playing;
+    publish_lobby_change(LobbyChange::state_changed, [&](OutByteStream& out) {
+        out << varint{lobby_index} << lobby.state;
+    });
     OutByteStream msg;
-    msg << MessageType::lobby_start << server;
+    msg << MessageType::lobby_start << server << varint{uint32_t(server_wait.count())};
     for (auto& player : lobby.players) {
         spdlog::info("lanching client on port {}", player.peer->address.port);
-        while (send_bytes<true>(msg.get_span(), player.peer) != 0) {
-
-        }
+        m_outbox.send(player.peer, msg.get_span(), s_launch_timeout, [this, lobby_index](ENetPeer* peer) {
+            auto slot = m_player_slots.find(peer);
+            if (slot != m_player_slots.end() && slot->second.lobby == lobby_index) {
+                spdlog::warn("player on port {} dropped from the launch of lobby {}", peer->address.port, m_lobbies[lobby_index].name);
+                remove_from_lobby(peer);
+            }
+        });
     }
     m_pending_games.erase(lobby.name);
     spdlog::info("launched lobby {}", lobby.name);
@@ -180,5 +307,11 @@ void MatchMakingServer::on_start() {
         }
         return true;
     }, 1s);
+    m_task_manager.add_task([this] {
+        m_queue.form_matches(game_clock_t::now(), [this](match_queue_t::Match&& match) {
+            create_queue_lobby(std::move(match));
+        });
+        return true;
+    }, s_queue_period);
 }
 
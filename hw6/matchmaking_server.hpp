@@ -1,6 +1,7 @@
 #pragma once
 
 #include <chrono>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 #include <string_view>
@@ -9,6 +10,8 @@
 
 #include "lobby.hpp"
 #include "common.hpp"
+#include "matchmaking_queue.hpp"
+#include "peer_outbox.hpp"
 #include "server_provider.hpp"
 #include "base_server.hpp"
 
@@ -18,13 +21,59 @@ public:
     MatchMakingServer(ENetHost* host): BaseServer(host) {}
 
     static constexpr std::chrono::milliseconds s_update_time = 100ms;
+    // one more provider is asked for a server if none has answered in this time
+    static constexpr std::chrono::milliseconds s_hedge_delay = 1s;
+    // after it lobby request is dropped and made again from scratch
+    static constexpr std::chrono::milliseconds s_server_request_timeout = 10s;
+    static constexpr ScheduleMode s_schedule_mode = ScheduleMode::event_driven;
+    // players in lobbies formed from the queue
+    static constexpr size_t s_queue_lobby_size = 8;
+    static constexpr std::chrono::milliseconds s_queue_period = 500ms;
+    // player who can't be told where the game is in this time is dropped from the lobby
+    static constexpr std::chrono::milliseconds s_launch_timeout = 5s;
 private:
+    using match_queue_t = MatchQueue<ENetPeer*, game_clock_t>;
+
+    // position of a player: index of the lobby in m_lobbies and of the player in it
+    struct LobbySlot {
+        uint32_t lobby;
+        uint32_t player;
+    };
+
+    // lobbies are never removed, so their indices are stable
     std::vector<server_lobby_t> m_lobbies;
+    std::unordered_map<std::string, uint32_t> m_lobby_by_name;
+    std::unordered_map<const ENetPeer*, LobbySlot> m_player_slots;
     std::vector<ServerProvider> m_providers;
     std::unordered_set<std::string> m_pending_games;
+    // when the lobby asked for a server, to log how long it took to get one
+    std::unordered_map<std::string, game_clock_t::time_point> m_server_requested;
+    // peers getting lobby changes as they happen
+    std::unordered_set<const ENetPeer*> m_lobby_subscribers;
+    uint32_t m_lobby_version = 0;
+    match_queue_t m_queue = match_queue_t(s_queue_lobby_size);
+    std::unordered_map<const ENetPeer*, std::string> m_queued_names;
+    uint32_t m_queue_lobbies = 0;
+    PeerOutbox m_outbox = PeerOutbox(m_task_manager);
+
+    // Sends the change to every subscriber, write_change writes what follows the change type
+    template<typename F>
+    void publish_lobby_change(LobbyChange change, F&& write_change) {
+        ++m_lobby_version;
+        if (m_lobby_subscribers.empty()) {
+            return;
+        }
+        auto msg = acquire_packet_stream();
+        msg << MessageType::lobby_diff << varint{m_lobby_version} << change;
+        write_change(msg);
+        send_to_peers<true>(create_packet<true>(std::move(msg)), get_peers(), [this](const ENetPeer& peer) {
+            return m_lobby_subscribers.contains(&peer);
+        });
+    }
   
     void make_game_server(const server_lobby_t& lobby);
-    void launch_lobby(server_lobby_t& lobby, const GameServerInfo& server);
+    void launch_lobby(server_lobby_t& lobby, const GameServerInfo& server, std::chrono::milliseconds server_wait);
+    bool request_server(const std::string& lobby_name, const std::vector<Mod>& mods, std::vector<ENetPeer*>& asked);
 public:
     void update() {}
     void on_start(); 
@@ -34,6 +83,10 @@ public:
     void process_disconnect(ENetEvent&);
 
     void send_lobby_list(ENetPeer*);
+    void publish_player_change(LobbySlot slot);
+    server_lobby_t* find_lobby(const std::string& name);
+    void remove_from_lobby(const ENetPeer* peer);
+    void create_queue_lobby(match_queue_t::Match&& match);
 
     void start_lobby(server_lobby_t&);
 };
@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "matchmaking_queue.hpp"
+
+
+using namespace std::chrono_literals;
+
+struct SimulatedClock {
+    using duration = std::chrono::nanoseconds;
+    using rep = duration::rep;
+    using period = duration::period;
+    using time_point = std::chrono::time_point<SimulatedClock>;
+    static constexpr bool is_steady = true;
+};
+
+static constexpr size_t s_players = 100'000;
+static constexpr size_t s_lobby_size = 8;
+static constexpr auto s_pass_period = 500ms;
+// simulation stops once no lobby could be formed for this long with everyone queued
+static constexpr auto s_idle_timeout = 60s;
+
+template<typename T>
+static T percentile(std::vector<T>& values, double fraction) {
+    if (values.empty()) {
+        return {};
+    }
+    auto index = size_t(fraction * double(values.size() - 1));
+    std::nth_element(values.begin(), values.begin() + ptrdiff_t(index), values.end());
+    return values[index];
+}
+
+// Players with normally distributed MMR join at the given rate (all at once if it is zero),
+// the queue forms lobbies every s_pass_period of simulated time
+static void run(const char* name, size_t arrivals_per_second) {
+    MatchQueue<uint32_t, SimulatedClock> queue(s_lobby_size);
+    std::mt19937 generator(42);
+    std::normal_distribution<float> mmr_distribution(1500.0f, 300.0f);
+
+    std::vector<double> waits;
+    std::vector<uint16_t> spreads;
+    waits.reserve(s_players / s_lobby_size);
+    spreads.reserve(s_players / s_lobby_size);
+    auto on_match = [&](auto&& match) {
+        waits.push_back(std::chrono::duration<double>(match.max_wait).count());
+        spreads.push_back(uint16_t(match.max_mmr - match.min_mmr));
+    };
+
+    auto per_pass = arrivals_per_second == 0
+        ? s_players
+        : size_t(double(arrivals_per_second) * std::chrono::duration<double>(s_pass_period).count());
+    SimulatedClock::time_point now;
+    SimulatedClock::time_point last_match;
+    uint32_t queued = 0;
+    size_t passes = 0;
+    double pass_us = 0.0;
+    double max_pass_us = 0.0;
+    while (queued < s_players || (queue.size() >= s_lobby_size && now - last_match < s_idle_timeout)) {
+        for (size_t i = 0; i < per_pass && queued < s_players; ++i) {
+            auto mmr = std::clamp(mmr_distribution(generator), 0.0f, 5000.0f);
+            queue.enqueue(queued++, uint16_t(mmr), now);
+        }
+        auto start = std::chrono::steady_clock::now();
+        if (queue.form_matches(now, on_match) > 0) {
+            last_match = now;
+        }
+        auto us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        pass_us += us;
+        max_pass_us = std::max(max_pass_us, us);
+        ++passes;
+        now += s_pass_period;
+    }
+
+    spdlog::info("{}: {} players, {} lobbies of {} in {:.1f} s of simulated time, {} left in queue",
+            name, queued, waits.size(), s_lobby_size,
+            std::chrono::duration<double>(last_match.time_since_epoch()).count(), queue.size());
+    spdlog::info("{}: pass {:.1f} us on average, {:.1f} us at most", name, pass_us / double(passes), max_pass_us);
+    spdlog::info("{}: formation time p50 {:.1f} s, p99 {:.1f} s, max {:.1f} s",
+            name, percentile(waits, 0.5), percentile(waits, 0.99), percentile(waits, 1.0));
+    spdlog::info("{}: mmr spread p50 {}, p99 {}, max {}",
+            name, percentile(spreads, 0.5), percentile(spreads, 0.99), percentile(spreads, 1.0));
+}
+
+int main() {
+    run("burst", 0);
+    run("steady", 2000);
+    run("sparse", 50);
+}
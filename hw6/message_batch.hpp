@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <utility>
+
+#include <enet/enet.h>
+
+#include <bytestream.hpp>
+
+#include "common.hpp"
+
+
+// Messages to the same peer are collected during a tick and sent as one packet of
+// MessageType::batch, every message in it is prefixed with its varint length.
+// Reliable and unreliable messages go on different channels, so they are batched separately.
+class MessageBatcher {
+    struct Batch {
+        OutByteStream stream = OutByteStream(0);
+        uint32_t messages = 0;
+    };
+
+    struct PeerBatches {
+        Batch reliable;
+        Batch unreliable;
+    };
+
+public:
+    // room left in a datagram for enet protocol and command headers
+    static constexpr size_t s_header_reserve = 64;
+    static constexpr size_t s_min_batch_size = 512;
+
+    MessageBatcher() = default;
+
+    MessageBatcher(const MessageBatcher&) = delete;
+    MessageBatcher& operator=(const MessageBatcher&) = delete;
+
+    // Batch is sent earlier if the message doesn't fit into the datagram with it,
+    // messages that don't fit into a datagram alone are sent right away
+    template<bool is_reliable>
+    void add(ENetPeer* peer, const std::span<std::byte>& message) {
+        auto& batch = get_batch<is_reliable>(peer);
+        auto limit = max_batch_size(*peer);
+        auto framed_size = varint_size(message.size()) + message.size();
+        if (batch.messages > 0 && batch.stream.size() + framed_size > limit) {
+            send<is_reliable>(peer, batch);
+        }
+        if (!fits_batch(*peer, message.size())) {
+            auto packet = create_packet<is_reliable>(message);
+            if (enet_peer_send(peer, packet_channel<is_reliable>(), packet) != 0) {
+                enet_packet_destroy(packet);
+            }
+            return;
+        }
+        if (batch.messages == 0) {
+            batch.stream = acquire_packet_stream(limit);
+            batch.stream << MessageType::batch;
+        }
+        batch.stream << varint{message.size()};
+        batch.stream.write(std::span<const std::byte>(message));
+        ++batch.messages;
+    }
+
+    void flush() {
+        for (auto& [peer, batches] : m_batches) {
+            send<true>(peer, batches.reliable);
+            send<false>(peer, batches.unreliable);
+        }
+    }
+
+    // Sends what is batched for the peer on one channel, so a message sent past the batcher doesn't overtake it
+    template<bool is_reliable>
+    void flush(ENetPeer* peer) {
+        if (auto batches = m_batches.find(peer); batches != m_batches.end()) {
+            send<is_reliable>(peer, get_batch<is_reliable>(peer));
+        }
+    }
+
+    // Whether the message can go into a batch to the peer at all
+    static bool fits_batch(const ENetPeer& peer, size_t message_size) {
+        return sizeof(MessageType) + varint_size(message_size) + message_size <= max_batch_size(peer);
+    }
+
+    // Forgets the messages to a disconnected peer
+    void discard(ENetPeer* peer) {
+        auto batches = m_batches.find(peer);
+        if (batches == m_batches.end()) {
+            return;
+        }
+        for (auto* batch : {&batches->second.reliable, &batches->second.unreliable}) {
+            if (batch->messages > 0) {
+                release_packet_buffer(batch->stream.release());
+            }
+        }
+        m_batches.erase(batches);
+    }
+
+private:
+    std::unordered_map<ENetPeer*, PeerBatches> m_batches;
+
+    static size_t max_batch_size(const ENetPeer& peer) {
+        return std::max(size_t(peer.mtu), s_min_batch_size + s_header_reserve) - s_header_reserve;
+    }
+
+    static size_t varint_size(size_t value) {
+        size_t size = 1;
+        for (; value >= 0x80; value >>= 7) {
+            ++size;
+        }
+        return size;
+    }
+
+    template<bool is_reliable>
+    Batch& get_batch(ENetPeer* peer) {
+        auto& batches = m_batches[peer];
+        if constexpr (is_reliable) {
+            return batches.reliable;
+        } else {
+            return batches.unreliable;
+        }
+    }
+
+    template<bool is_reliable>
+    void send(ENetPeer* peer, Batch& batch) {
+        if (batch.messages == 0) {
+            return;
+        }
+        send_stream<is_reliable>(std::move(batch.stream), peer);
+        batch.messages = 0;
+    }
+};
+
+// Calls handle(InByteStream&) for every message of the packet, the stream starts at the message type.
+// Packets that are not batches hold a single message.
+template<typename F>
+void for_each_message(const ENetPacket& packet, F&& handle) {
+    InByteStream istr(packet.data, packet.dataLength);
+    if (packet.dataLength == 0 || MessageType(packet.data[0]) != MessageType::batch) {
+        handle(istr);
+        return;
+    }
+    istr.get<MessageType>();
+    while (!istr.get_span().empty()) {
+        auto message = istr.substream(istr.get<varint<size_t>>().value);
+        handle(message);
+    }
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "game_object.hpp"
+#include "physics_kernels.hpp"
+
+
+// Game objects stored as a structure of arrays, so that physics
+// can be run over contiguous components with simd kernels.
+struct ObjectStore {
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> vx;
+    std::vector<float> vy;
+    std::vector<float> radius;
+    std::vector<uint32_t> id;
+
+    size_t size() const {
+        return id.size();
+    }
+
+    bool empty() const {
+        return id.empty();
+    }
+
+    void reserve(size_t capacity) {
+        x.reserve(capacity);
+        y.reserve(capacity);
+        vx.reserve(capacity);
+        vy.reserve(capacity);
+        radius.reserve(capacity);
+        id.reserve(capacity);
+    }
+
+    GameObject get(size_t index) const {
+        return {
+            .position = {x[index], y[index]},
+            .velocity = {vx[index], vy[index]},
+            .radius = radius[index],
+            .id = id[index]
+        };
+    }
+
+    void set(size_t index, const GameObject& object) {
+        x[index] = object.position.x;
+        y[index] = object.position.y;
+        vx[index] = object.velocity.x;
+        vy[index] = object.velocity.y;
+        radius[index] = object.radius;
+        id[index] = object.id;
+    }
+
+    vec2 position(size_t index) const {
+        return {x[index], y[index]};
+    }
+
+    void set_position(size_t index, vec2 position) {
+        x[index] = position.x;
+        y[index] = position.y;
+    }
+
+    void set_velocity(size_t index, vec2 velocity) {
+        vx[index] = velocity.x;
+        vy[index] = velocity.y;
+    }
+
+    void push_back(const GameObject& object) {
+        x.push_back(object.position.x);
+        y.push_back(object.position.y);
+        vx.push_back(object.velocity.x);
+        vy.push_back(object.velocity.y);
+        radius.push_back(object.radius);
+        id.push_back(object.id);
+    }
+
+    void pop_back() {
+        x.pop_back();
+        y.pop_back();
+        vx.pop_back();
+        vy.pop_back();
+        radius.pop_back();
+        id.pop_back();
+    }
+
+    PhysicsArrays physics_arrays() {
+        return {x.data(), y.data(), vx.data(), vy.data(), radius.data(), size()};
+    }
+
+    void integrate(float dt, vec2 borders) {
+        get_integrate_kernel()(physics_arrays(), dt, borders);
+    }
+};
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <span>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <enet/enet.h>
+#include <spdlog/spdlog.h>
+
+#include "common.hpp"
+#include "timed_task_manager.hpp"
+
+
+// Reliable messages which enet refused to queue for a peer wait here and are retried
+// from a task, so the event loop never spins on a full peer.
+// Messages to one peer keep their order, a message not sent before its deadline
+// is dropped together with everything queued after it and on_drop is called.
+class PeerOutbox {
+    struct Message {
+        ENetPacket* packet;
+        game_clock_t::time_point deadline;
+        std::function<void(ENetPeer*)> on_drop;
+    };
+
+public:
+    static constexpr std::chrono::milliseconds s_retry_interval = 10ms;
+
+    PeerOutbox(TimedTaskManager<game_clock_t>& tasks): m_tasks(tasks) {}
+
+    PeerOutbox(const PeerOutbox&) = delete;
+    PeerOutbox& operator=(const PeerOutbox&) = delete;
+
+    ~PeerOutbox() {
+        for (auto& [peer, messages] : m_queues) {
+            for (auto& message : messages) {
+                enet_packet_destroy(message.packet);
+            }
+        }
+        if (m_retry_task != TimedTaskManager<game_clock_t>::s_invalid_task) {
+            m_tasks.cancel(m_retry_task);
+        }
+    }
+
+    template<typename F>
+    void send(ENetPeer* peer, const std::span<std::byte>& bytes, std::chrono::milliseconds timeout, F&& on_drop) {
+        auto packet = create_packet<true>(bytes);
+        auto queue = m_queues.find(peer);
+        if (queue == m_queues.end()) {
+            if (enet_peer_send(peer, packet_channel<true>(), packet) == 0) {
+                return;
+            }
+            queue = m_queues.try_emplace(peer).first;
+        }
+        queue->second.push_back({packet, game_clock_t::now() + timeout, std::forward<F>(on_drop)});
+        schedule_retry();
+    }
+
+    // Forgets the messages to a peer without calling on_drop, for disconnected peers
+    void discard(ENetPeer* peer) {
+        auto queue = m_queues.find(peer);
+        if (queue == m_queues.end()) {
+            return;
+        }
+        for (auto& message : queue->second) {
+            enet_packet_destroy(message.packet);
+        }
+        m_queues.erase(queue);
+    }
+
+    size_t size() const {
+        size_t result = 0;
+        for (const auto& [peer, messages] : m_queues) {
+            result += messages.size();
+        }
+        return result;
+    }
+
+private:
+    TimedTaskManager<game_clock_t>& m_tasks;
+    std::unordered_map<ENetPeer*, std::deque<Message>> m_queues;
+    uint32_t m_retry_task = TimedTaskManager<game_clock_t>::s_invalid_task;
+
+    void schedule_retry() {
+        if (m_retry_task != TimedTaskManager<game_clock_t>::s_invalid_task) {
+            return;
+        }
+        m_retry_task = m_tasks.add_task([this] {
+            retry();
+            if (m_queues.empty()) {
+                m_retry_task = TimedTaskManager<game_clock_t>::s_invalid_task;
+                return false;
+            }
+            return true;
+        }, s_retry_interval);
+    }
+
+    void retry() {
+        auto now = game_clock_t::now();
+        std::vector<std::pair<ENetPeer*, std::function<void(ENetPeer*)>>> dropped;
+        for (auto it = m_queues.begin(); it != m_queues.end();) {
+            auto& [peer, messages] = *it;
+            while (!messages.empty() && peer->state == ENET_PEER_STATE_CONNECTED && messages.front().deadline > now
+                    && enet_peer_send(peer, packet_channel<true>(), messages.front().packet) == 0) {
+                messages.pop_front();
+            }
+            if (!messages.empty() && (peer->state != ENET_PEER_STATE_CONNECTED || messages.front().deadline <= now)) {
+                spdlog::warn("dropping {} messages to port {}, could not send them in time", messages.size(), peer->address.port);
+                for (auto& message : messages) {
+                    enet_packet_destroy(message.packet);
+                    if (message.on_drop) {
+                        dropped.emplace_back(peer, std::move(message.on_drop));
+                    }
+                }
+                messages.clear();
+            }
+            it = messages.empty() ? m_queues.erase(it) : std::next(it);
+        }
+        // callbacks may send again, so they run once the queues are not iterated
+        for (auto& [peer, on_drop] : dropped) {
+            on_drop(peer);
+        }
+    }
+};
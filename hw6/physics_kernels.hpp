@@ -0,0 +1,158 @@
+#pragma once
+
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PHYSICS_KERNELS_X86
+#endif
+
+#include "game_object.hpp"
+
+
+// Pointers to separate arrays of object components, see ObjectStore
+struct PhysicsArrays {
+    float* x;
+    float* y;
+    float* vx;
+    float* vy;
+    const float* radius;
+    size_t size;
+};
+
+inline constexpr float s_friction = 0.3f;
+
+// All kernels perform exactly the same float operations in the same order
+// (no fma), so results are bit-identical whichever of them is used.
+// Client prediction relies on it. hw6 is built with -ffp-contract=off,
+// otherwise the compiler may fuse a * b + c in the scalar kernel on fma targets.
+inline void integrate_scalar(const PhysicsArrays& arrays, size_t begin, float dt, vec2 borders) {
+    for (size_t i = begin; i < arrays.size; ++i) {
+        float r = arrays.radius[i];
+        float vx = arrays.vx[i] - arrays.vx[i] * s_friction * dt;
+        float vy = arrays.vy[i] - arrays.vy[i] * s_friction * dt;
+        float x = arrays.x[i] + vx * dt;
+        float y = arrays.y[i] + vy * dt;
+        if (x + r > borders.x) {
+            x = borders.x - r;
+        }
+        if (x - r < 0.0f) {
+            x = r;
+        }
+        if (y + r > borders.y) {
+            y = borders.y - r;
+        }
+        if (y - r < 0.0f) {
+            y = r;
+        }
+        arrays.vx[i] = vx;
+        arrays.vy[i] = vy;
+        arrays.x[i] = x;
+        arrays.y[i] = y;
+    }
+}
+
+inline void integrate_scalar(const PhysicsArrays& arrays, float dt, vec2 borders) {
+    integrate_scalar(arrays, 0, dt, borders);
+}
+
+#ifdef PHYSICS_KERNELS_X86
+
+__attribute__((target("sse2")))
+inline __m128 clamp_sse(__m128 coord, __m128 radius, __m128 border) {
+    auto zero = _mm_setzero_ps();
+    auto over = _mm_cmpgt_ps(_mm_add_ps(coord, radius), border);
+    coord = _mm_or_ps(_mm_and_ps(over, _mm_sub_ps(border, radius)), _mm_andnot_ps(over, coord));
+    auto under = _mm_cmplt_ps(_mm_sub_ps(coord, radius), zero);
+    return _mm_or_ps(_mm_and_ps(under, radius), _mm_andnot_ps(under, coord));
+}
+
+__attribute__((target("sse2")))
+inline void integrate_sse(const PhysicsArrays& arrays, float dt, vec2 borders) {
+    constexpr size_t width = 4;
+    auto dt_v = _mm_set1_ps(dt);
+    auto friction = _mm_set1_ps(s_friction);
+    auto border_x = _mm_set1_ps(borders.x);
+    auto border_y = _mm_set1_ps(borders.y);
+    size_t i = 0;
+    for (; i + width <= arrays.size; i += width) {
+        auto r = _mm_loadu_ps(arrays.radius + i);
+        auto vx = _mm_loadu_ps(arrays.vx + i);
+        auto vy = _mm_loadu_ps(arrays.vy + i);
+        vx = _mm_sub_ps(vx, _mm_mul_ps(_mm_mul_ps(vx, friction), dt_v));
+        vy = _mm_sub_ps(vy, _mm_mul_ps(_mm_mul_ps(vy, friction), dt_v));
+        auto x = _mm_add_ps(_mm_loadu_ps(arrays.x + i), _mm_mul_ps(vx, dt_v));
+        auto y = _mm_add_ps(_mm_loadu_ps(arrays.y + i), _mm_mul_ps(vy, dt_v));
+        _mm_storeu_ps(arrays.vx + i, vx);
+        _mm_storeu_ps(arrays.vy + i, vy);
+        _mm_storeu_ps(arrays.x + i, clamp_sse(x, r, border_x));
+        _mm_storeu_ps(arrays.y + i, clamp_sse(y, r, border_y));
+    }
+    integrate_scalar(arrays, i, dt, borders);
+}
+
+__attribute__((target("avx2")))
+inline __m256 clamp_avx2(__m256 coord, __m256 radius, __m256 border) {
+    auto zero = _mm256_setzero_ps();
+    auto over = _mm256_cmp_ps(_mm256_add_ps(coord, radius), border, _CMP_GT_OQ);
+    coord = _mm256_blendv_ps(coord, _mm256_sub_ps(border, radius), over);
+    auto under = _mm256_cmp_ps(_mm256_sub_ps(coord, radius), zero, _CMP_LT_OQ);
+    return _mm256_blendv_ps(coord, radius, under);
+}
+
+__attribute__((target("avx2")))
+inline void integrate_avx2(const PhysicsArrays& arrays, float dt, vec2 borders) {
+    constexpr size_t width = 8;
+    auto dt_v = _mm256_set1_ps(dt);
+    auto friction = _mm256_set1_ps(s_friction);
+    auto border_x = _mm256_set1_ps(borders.x);
+    auto border_y = _mm256_set1_ps(borders.y);
+    size_t i = 0;
+    for (; i + width <= arrays.size; i += width) {
+        auto r = _mm256_loadu_ps(arrays.radius + i);
+        auto vx = _mm256_loadu_ps(arrays.vx + i);
+        auto vy = _mm256_loadu_ps(arrays.vy + i);
+        vx = _mm256_sub_ps(vx, _mm256_mul_ps(_mm256_mul_ps(vx, friction), dt_v));
+        vy = _mm256_sub_ps(vy, _mm256_mul_ps(_mm256_mul_ps(vy, friction), dt_v));
+        auto x = _mm256_add_ps(_mm256_loadu_ps(arrays.x + i), _mm256_mul_ps(vx, dt_v));
+        auto y = _mm256_add_ps(_mm256_loadu_ps(arrays.y + i), _mm256_mul_ps(vy, dt_v));
+        _mm256_storeu_ps(arrays.vx + i, vx);
+        _mm256_storeu_ps(arrays.vy + i, vy);
+        _mm256_storeu_ps(arrays.x + i, clamp_avx2(x, r, border_x));
+        _mm256_storeu_ps(arrays.y + i, clamp_avx2(y, r, border_y));
+    }
+    integrate_scalar(arrays, i, dt, borders);
+}
+
+#endif
+
+using integrate_kernel_t = void(*)(const PhysicsArrays&, float, vec2);
+
+// Picks the widest kernel supported by the cpu we are running on
+inline integrate_kernel_t get_integrate_kernel() {
+    static const integrate_kernel_t kernel = [] () -> integrate_kernel_t {
+#ifdef PHYSICS_KERNELS_X86
+        if (__builtin_cpu_supports("avx2")) {
+            return integrate_avx2;
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            return integrate_sse;
+        }
+#endif
+        return integrate_scalar;
+    }();
+    return kernel;
+}
+
+// Friction, movement and border clamping for a single object
+inline void integrate_object(GameObject& object, float dt, vec2 borders) {
+    PhysicsArrays arrays = {
+        .x = &object.position.x,
+        .y = &object.position.y,
+        .vx = &object.velocity.x,
+        .vy = &object.velocity.y,
+        .radius = &object.radius,
+        .size = 1
+    };
+    integrate_scalar(arrays, dt, borders);
+}
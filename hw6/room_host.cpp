@@ -0,0 +1,176 @@
+#include "room_host.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <spdlog/spdlog.h>
+
+
+static void pin_to_core(size_t index) {
+#ifdef __linux__
+    auto num_cores = std::max(std::thread::hardware_concurrency(), 1u);
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(index % num_cores, &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+        spdlog::warn("could not pin room worker {} to a core", index);
+    }
+#endif
+}
+
+RoomHost::RoomHost(size_t num_workers) {
+    if (num_workers == 0) {
+        num_workers = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    m_workers.reserve(num_workers);
+    for (size_t i = 0; i < num_workers; ++i) {
+        m_workers.push_back(std::make_unique<Worker>());
+    }
+    // threads are started once all workers exist, as they look at each other when rebalancing
+    for (size_t i = 0; i < num_workers; ++i) {
+        m_workers[i]->thread = std::jthread([this, i](std::stop_token stop) { run_worker(i, stop); });
+    }
+    spdlog::info("room host started with {} workers", num_workers);
+}
+
+RoomHost::~RoomHost() {
+    for (auto& worker : m_workers) {
+        worker->thread.request_stop();
+    }
+    for (auto& worker : m_workers) {
+        worker->thread.join();
+        for (auto& room : worker->inbox) {
+            destroy_room(*room);
+        }
+    }
+}
+
+uint16_t RoomHost::create_room(const std::string& name, uint16_t port) {
+    ENetHost* host;
+    try {
+        host = create_host(port);
+    } catch (const std::runtime_error& error) {
+        spdlog::error("could not create room \"{}\": {}", name, error.what());
+        return 0;
+    }
+    auto room = std::make_unique<Room>();
+    room->host = host;
+    // rooms share the terminal, so none of them draws the player table
+    room->server = std::make_unique<GameServer>(host, name, host->address.port, 0ms);
+    auto room_port = host->address.port;
+    give_room(least_loaded_worker(), std::move(room));
+    spdlog::info("created room \"{}\" on port {}", name, room_port);
+    return room_port;
+}
+
+size_t RoomHost::num_rooms() const {
+    size_t result = 0;
+    for (const auto& worker : m_workers) {
+        result += worker->num_rooms;
+    }
+    return result;
+}
+
+void RoomHost::run_worker(size_t index, std::stop_token stop) {
+    pin_to_core(index);
+    auto& worker = *m_workers[index];
+    while (!stop.stop_requested()) {
+        {
+            std::lock_guard lock(worker.inbox_mutex);
+            for (auto& room : worker.inbox) {
+                worker.rooms.push_back(std::move(room));
+            }
+            worker.inbox.clear();
+        }
+        for (auto& room : worker.rooms) {
+            if (!room->started) {
+                room->server->start();
+                room->started = true;
+            }
+        }
+
+        wait_for_events(worker, stop);
+        for (auto& room : worker.rooms) {
+            room->server->step(0);
+        }
+
+        auto finished = std::partition(worker.rooms.begin(), worker.rooms.end(), [](const auto& room) {
+            return room->server->alive();
+        });
+        for (auto it = finished; it != worker.rooms.end(); ++it) {
+            (*it)->server->finish();
+            destroy_room(**it);
+        }
+        worker.num_rooms -= size_t(worker.rooms.end() - finished);
+        worker.rooms.erase(finished, worker.rooms.end());
+
+        rebalance(index);
+    }
+
+    for (auto& room : worker.rooms) {
+        if (room->started) {
+            room->server->finish();
+        }
+        destroy_room(*room);
+    }
+    worker.rooms.clear();
+}
+
+// Blocks until one of the rooms has a packet or a task to run,
+// or until a room is given to an idle worker
+void RoomHost::wait_for_events(Worker& worker, std::stop_token stop) {
+    if (worker.rooms.empty()) {
+        std::unique_lock lock(worker.inbox_mutex);
+        worker.inbox_ready.wait(lock, stop, [&worker] { return !worker.inbox.empty(); });
+        return;
+    }
+
+    ENetSocketSet sockets;
+    ENET_SOCKETSET_EMPTY(sockets);
+    ENetSocket max_socket = 0;
+    auto deadline = game_clock_t::time_point::max();
+    for (const auto& room : worker.rooms) {
+        ENET_SOCKETSET_ADD(sockets, room->host->socket);
+        max_socket = std::max(max_socket, room->host->socket);
+        deadline = std::min(deadline, room->server->next_deadline());
+    }
+    enet_socketset_select(max_socket, &sockets, nullptr, GameServer::time_until(deadline));
+}
+
+// Hands one room over if this worker has at least two rooms more than the least loaded one
+void RoomHost::rebalance(size_t index) {
+    auto& worker = *m_workers[index];
+    auto& target = least_loaded_worker();
+    if (&target == &worker || worker.rooms.empty() || worker.num_rooms < target.num_rooms + 2) {
+        return;
+    }
+    auto room = std::move(worker.rooms.back());
+    worker.rooms.pop_back();
+    --worker.num_rooms;
+    give_room(target, std::move(room));
+}
+
+RoomHost::Worker& RoomHost::least_loaded_worker() {
+    return **std::ranges::min_element(m_workers, [](const auto& first, const auto& second) {
+        return first->num_rooms < second->num_rooms;
+    });
+}
+
+void RoomHost::give_room(Worker& worker, std::unique_ptr<Room> room) {
+    {
+        std::lock_guard lock(worker.inbox_mutex);
+        worker.inbox.push_back(std::move(room));
+        ++worker.num_rooms;
+    }
+    worker.inbox_ready.notify_one();
+}
+
+void RoomHost::destroy_room(Room& room) {
+    room.server.reset();
+    enet_host_destroy(room.host);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <enet/enet.h>
+
+#include "game_server.hpp"
+
+
+// Runs many GameServer rooms inside one process on a fixed pool of worker threads.
+// Every worker is pinned to its own core and owns a set of rooms: it waits on the sockets
+// of all of them at once until the earliest task deadline, then steps every room.
+// Overloaded workers hand rooms over to the least loaded one.
+class RoomHost {
+    struct Room {
+        ENetHost* host;
+        std::unique_ptr<GameServer> server;
+        bool started = false;
+    };
+
+    struct Worker {
+        // touched only by the worker thread
+        std::vector<std::unique_ptr<Room>> rooms;
+        // rooms given to this worker by others
+        std::mutex inbox_mutex;
+        std::condition_variable_any inbox_ready;
+        std::vector<std::unique_ptr<Room>> inbox;
+        std::atomic<size_t> num_rooms = 0;
+        std::jthread thread;
+    };
+
+public:
+    // num_workers of zero means one worker per core
+    explicit RoomHost(size_t num_workers = 0);
+    ~RoomHost();
+
+    // Creates a room listening on the given port (0 to pick any free one).
+    // Returns the port or 0 if the room couldn't be created.
+    uint16_t create_room(const std::string& name, uint16_t port = 0);
+
+    size_t num_rooms() const;
+
+private:
+    std::vector<std::unique_ptr<Worker>> m_workers;
+
+    void run_worker(size_t index, std::stop_token stop);
+    void wait_for_events(Worker& worker, std::stop_token stop);
+    void rebalance(size_t index);
+    Worker& least_loaded_worker();
+    static void give_room(Worker& worker, std::unique_ptr<Room> room);
+    static void destroy_room(Room& room);
+};
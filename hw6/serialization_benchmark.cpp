@@ -0,0 +1,153 @@
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "lobby.hpp"
+
+
+static constexpr size_t s_lobbies = 2'000;
+static constexpr size_t s_players_per_lobby = 8;
+static constexpr size_t s_repeats = 200;
+static constexpr size_t s_messages = 1'000'000;
+
+// Same fields as GameServerInfo and Player, with the operators written by hand
+struct HandWrittenServerInfo {
+    ENetAddress address;
+    uint64_t id;
+};
+
+inline OutByteStream& operator<<(OutByteStream& ostr, const HandWrittenServerInfo& info) {
+    return ostr << info.address.host << info.address.port << info.id;
+}
+
+inline InByteStream& operator>>(InByteStream& istr, HandWrittenServerInfo& info) {
+    return istr >> info.address.host >> info.address.port >> info.id;
+}
+
+struct HandWrittenPlayer {
+    std::string name;
+    PlayerAddress address;
+    bool ready;
+    uint32_t id;
+    uint32_t ping;
+};
+
+inline OutByteStream& operator<<(OutByteStream& ostr, const HandWrittenPlayer& player) {
+    return ostr << player.name << player.address.host << player.address.port << player.ready << player.id << player.ping;
+}
+
+inline InByteStream& operator>>(InByteStream& istr, HandWrittenPlayer& player) {
+    return istr >> player.name >> player.address.host >> player.address.port >> player.ready >> player.id >> player.ping;
+}
+
+static uint64_t checksum(const GameServerInfo& info) {
+    return info.id + info.address.port;
+}
+
+static uint64_t checksum(const HandWrittenServerInfo& info) {
+    return info.id + info.address.port;
+}
+
+static uint64_t checksum(const Player& player) {
+    return player.id + player.ping + player.name.size();
+}
+
+static uint64_t checksum(const HandWrittenPlayer& player) {
+    return player.id + player.ping + player.name.size();
+}
+
+template<typename T>
+static T make_message(size_t i) {
+    T message{};
+    if constexpr (requires { message.name; }) {
+        message.name = fmt::format("player {}", i % 100);
+        message.ping = uint32_t(i % 300);
+    }
+    message.address.port = uint16_t(i);
+    message.id = uint32_t(i);
+    return message;
+}
+
+// Writes every message into a reused stream and reads it back
+template<typename T>
+static void run_messages(const char* name) {
+    auto message = make_message<T>(7);
+    T decoded{};
+    uint64_t sum = 0;
+    OutByteStream ostr;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < s_messages; ++i) {
+        message.id = uint32_t(i);
+        ostr.reset();
+        ostr << message;
+        auto bytes = ostr.get_span();
+        InByteStream istr(bytes.data(), bytes.size());
+        istr >> decoded;
+        sum += checksum(decoded);
+    }
+    auto total_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    spdlog::info("{:>22}: {} bytes, {:.1f} ns per message (checksum {})", name, ostr.size(), total_ns / double(s_messages), sum);
+}
+
+// Fixed size messages packed into a buffer on the stack, no stream involved
+template<fixed_size_reflected T>
+static void run_packed(const char* name) {
+    auto message = make_message<T>(7);
+    uint64_t sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < s_messages; ++i) {
+        message.id = uint32_t(i);
+        auto bytes = pack(message);
+        sum += checksum(unpack<T>(bytes));
+    }
+    auto total_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    spdlog::info("{:>22}: {} bytes, {:.1f} ns per message (checksum {})", name, wire_size_v<T>, total_ns / double(s_messages), sum);
+}
+
+static std::vector<client_lobby_t> make_lobbies() {
+    std::vector<client_lobby_t> lobbies(s_lobbies);
+    for (size_t i = 0; i < lobbies.size(); ++i) {
+        auto& lobby = lobbies[i];
+        lobby.name = fmt::format("lobby number {} of the benchmark", i);
+        lobby.description = fmt::format("description of the lobby {}, long enough to not fit into a small string", i);
+        for (size_t j = 0; j < s_players_per_lobby; ++j) {
+            lobby.players.push_back({fmt::format("player {} in lobby {}", j, i), PlayerAddress{}, j % 2 == 0});
+        }
+        lobby.max_players = 16;
+        lobby.state = LobbyState::waiting;
+    }
+    return lobbies;
+}
+
+// Decodes the list the way the client does, into lobbies kept from the previous update
+static void run(const char* name, WireFormat format, const std::vector<client_lobby_t>& lobbies) {
+    OutByteStream ostr;
+    ostr.set_wire_format(format);
+    ostr << lobbies;
+    auto bytes = ostr.get_span();
+
+    std::vector<client_lobby_t> decoded;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t repeat = 0; repeat < s_repeats; ++repeat) {
+        InByteStream istr(bytes.data(), bytes.size());
+        istr.set_wire_format(format);
+        istr >> decoded;
+    }
+    auto total_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    spdlog::info("{:>16}: {} bytes, {:.1f} us per list of {} lobbies", name, bytes.size(), total_us / double(s_repeats), lobbies.size());
+}
+
+int main() {
+    auto lobbies = make_lobbies();
+    run("legacy", WireFormat::legacy, lobbies);
+    run("current", WireFormat::current, lobbies);
+
+    run_messages<HandWrittenServerInfo>("hand written info");
+    run_messages<GameServerInfo>("reflected info");
+    run_packed<GameServerInfo>("reflected info, packed");
+    run_messages<HandWrittenPlayer>("hand written player");
+    run_messages<Player>("reflected player");
+}
@@ -1,25 +1,63 @@
 #include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
 #include <spdlog/spdlog.h>
 
 #include "game_server.hpp"
 #include "lobby.hpp"
 
 
+static uint32_t option_value(std::string_view arg) {
+    return uint32_t(std::stoul(std::string(arg.substr(arg.find('=') + 1))));
+}
+
 int main(int argc, char** argv) {
+    static constexpr const char* s_usage =
+        "Usage: [port] [name | --name=name] [--headless] [--status-period=ms] [--warm=proxy port] [mods...]";
     if (argc < 3) {
-        spdlog::error("not enough command line arguments. Usage: [port], [name], [mods...]");
+        spdlog::error("not enough command line arguments. {}", s_usage);
         return 1;
     }
 
+    // port 0 binds any free port
     uint16_t port = std::stoul(argv[1]);
-    auto name = argv[2];
+    std::optional<std::string> name;
+    auto status_period = GameServer::s_default_status_period;
+    uint16_t proxy_port = 0;
     std::vector<Mod> mods;
-    for (int i = 3; i < argc; ++i) {
-        mods.emplace_back(argv[i]);
+    for (int i = 2; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg == "--headless") {
+            status_period = 0ms;
+        } else if (arg.starts_with("--status-period=")) {
+            status_period = std::chrono::milliseconds(option_value(arg));
+        } else if (arg.starts_with("--warm=")) {
+            proxy_port = uint16_t(option_value(arg));
+        } else if (arg.starts_with("--name=") && !name.has_value()) {
+            // the proxy passes names this way, so a name starting with -- isn't taken for a flag
+            name = std::string(arg.substr(arg.find('=') + 1));
+        } else if (arg.starts_with("--")) {
+            spdlog::error("unknown option {}. {}", arg, s_usage);
+            return 1;
+        } else if (!name.has_value()) {
+            name = std::string(arg);
+        } else {
+            mods.emplace_back(argv[i]);
+        }
+    }
+    // a warm server gets its lobby and mods from the proxy
+    if (proxy_port != 0 && (name.has_value() || !mods.empty())) {
+        spdlog::error("warm server takes no lobby name or mods. {}", s_usage);
+        return 1;
+    }
+    if (proxy_port == 0 && (!name.has_value() || name->empty())) {
+        spdlog::error("server needs either a lobby name or a proxy to get it from. {}", s_usage);
+        return 1;
     }
 
     auto host = create_host(port);
-    GameServer server(host, name, port);
+    GameServer server(host, name.value_or(""), host->address.port, status_period, proxy_port);
     server.run();
     enet_host_destroy(host);
 }
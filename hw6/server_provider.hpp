@@ -1,5 +1,7 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <optional>
 #include <enet/enet.h>
 
@@ -7,20 +9,61 @@
 #include "lobby.hpp"
 
 
+// Periodic report of a proxy about the game servers it runs
+struct ProviderLoad {
+    uint32_t running_servers = 0;
+    // zero if the proxy doesn't limit the number of servers
+    uint32_t max_servers = 0;
+    // servers that can take a lobby without starting up
+    uint32_t warm_servers = 0;
+    // load average per core
+    float cpu_load = 0.0f;
+
+    SERIALIZED_FIELDS(running_servers, max_servers, warm_servers, cpu_load)
+};
+
 class ServerProvider {
 public:
-    ServerProvider(ENetPeer* peer): proxy(peer) {}
+    // provider is considered dead if it hasn't reported its load for this long
+    static constexpr std::chrono::milliseconds s_report_timeout = 3s;
+
+    ServerProvider(ENetPeer* peer): proxy(peer), m_last_report(game_clock_t::now()) {}
 
     void request_server(const std::vector<Mod>& mods, const std::string& name) {
         spdlog::info("asking port {} for a new server", proxy->address.port);
         OutByteStream msg;
-        msg << MessageType::lobby_start << name << mods.size();
-        for (const auto& mod : mods) {
-            msg << mod;
-        }
+        msg << MessageType::lobby_start << name << mods;
         send_bytes<true>(msg.get_span(), proxy);
+        ++m_pending_requests;
+    }
+
+    void update_load(const ProviderLoad& load) {
+        m_load = load;
+        m_last_report = game_clock_t::now();
+        // the report already counts servers started for earlier requests
+        m_pending_requests = 0;
+    }
+
+    bool available(game_clock_t::time_point now) const {
+        bool has_capacity = m_load.max_servers == 0 || m_load.running_servers + m_pending_requests < m_load.max_servers;
+        return has_capacity && now - m_last_report < s_report_timeout;
+    }
+
+    // Lower is better: occupancy plus cpu load, a free warm server wins over everything else
+    float load() const {
+        float servers = float(m_load.running_servers + m_pending_requests);
+        float occupancy = m_load.max_servers > 0 ? servers / float(m_load.max_servers) : servers;
+        float warm_bonus = m_load.warm_servers > m_pending_requests ? 1.0f : 0.0f;
+        return occupancy + m_load.cpu_load - warm_bonus;
+    }
+
+    ENetPeer* peer() const {
+        return proxy;
     }
 
 private:
-    ENetPeer* const proxy;
+    ENetPeer* proxy;
+    ProviderLoad m_load;
+    game_clock_t::time_point m_last_report;
+    uint32_t m_pending_requests = 0;
 };
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+
+// Maps ids to positions in a dense array in O(1).
+// An id is a slot number combined with the generation of that slot,
+// so an id of a removed item never resolves to an item created later.
+class SlotIndex {
+    struct Slot {
+        uint32_t dense_index;
+        uint32_t generation;
+    };
+
+public:
+    static constexpr uint32_t s_invalid = uint32_t(-1);
+    static constexpr uint32_t s_slot_bits = 20;
+    static constexpr uint32_t s_slot_mask = (1u << s_slot_bits) - 1;
+    static constexpr uint32_t s_max_generation = (1u << (32 - s_slot_bits)) - 1;
+
+    uint32_t insert(uint32_t dense_index) {
+        uint32_t slot;
+        if (m_free_slots.empty()) {
+            slot = uint32_t(m_slots.size());
+            m_slots.push_back({dense_index, 0});
+        } else {
+            slot = m_free_slots.back();
+            m_free_slots.pop_back();
+            m_slots[slot].dense_index = dense_index;
+        }
+        return make_id(slot, m_slots[slot].generation);
+    }
+
+    void erase(uint32_t id) {
+        auto slot = id & s_slot_mask;
+        if (find(id) == s_invalid) {
+            return;
+        }
+        auto& item = m_slots[slot];
+        item.dense_index = s_invalid;
+        // last generation is skipped, so that s_invalid is never a valid id
+        item.generation = item.generation + 1 == s_max_generation ? 0 : item.generation + 1;
+        m_free_slots.push_back(slot);
+    }
+
+    // Should be called when item with the given id was moved in the dense array
+    void relocate(uint32_t id, uint32_t dense_index) {
+        m_slots[id & s_slot_mask].dense_index = dense_index;
+    }
+
+    uint32_t find(uint32_t id) const {
+        auto slot = id & s_slot_mask;
+        if (slot >= m_slots.size() || m_slots[slot].generation != id >> s_slot_bits) {
+            return s_invalid;
+        }
+        return m_slots[slot].dense_index;
+    }
+
+private:
+    std::vector<Slot> m_slots;
+    std::vector<uint32_t> m_free_slots;
+
+    static uint32_t make_id(uint32_t slot, uint32_t generation) {
+        return (generation << s_slot_bits) | slot;
+    }
+};
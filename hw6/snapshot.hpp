@@ -0,0 +1,269 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <bytestream.hpp>
+
+#include "game_object.hpp"
+
+
+inline constexpr uint32_t s_no_snapshot = uint32_t(-1);
+
+// State of the world at some tick, objects are sorted by id
+struct ObjectsSnapshot {
+    uint32_t sequence = s_no_snapshot;
+    std::vector<GameObject> objects;
+};
+
+// Ring of the last SIZE snapshots, older ones are overwritten
+template<size_t SIZE>
+class SnapshotHistory {
+public:
+    ObjectsSnapshot& push(uint32_t sequence) {
+        auto& snapshot = m_snapshots[sequence % SIZE];
+        snapshot.sequence = sequence;
+        snapshot.objects.clear();
+        return snapshot;
+    }
+
+    const ObjectsSnapshot* find(uint32_t sequence) const {
+        if (sequence == s_no_snapshot) {
+            return nullptr;
+        }
+        const auto& snapshot = m_snapshots[sequence % SIZE];
+        return snapshot.sequence == sequence ? &snapshot : nullptr;
+    }
+
+private:
+    std::array<ObjectsSnapshot, SIZE> m_snapshots;
+};
+
+enum DeltaField : uint8_t {
+    delta_position = 1 << 0,
+    delta_velocity = 1 << 1,
+    delta_radius = 1 << 2,
+    delta_all = delta_position | delta_velocity | delta_radius
+};
+inline constexpr uint32_t s_delta_field_bits = 3;
+
+// Precision of GameObject fields on the wire, 59 bits per object plus its id
+struct ObjectFormat {
+    FixedPoint position;
+    FixedPoint velocity;
+    FixedPoint radius;
+};
+
+inline constexpr ObjectFormat s_object_format = {
+    .position = {0.0f, 32.0f, 1.0f / 512.0f},
+    .velocity = {-8.0f, 8.0f, 1.0f / 64.0f},
+    .radius = {0.0f, 4.0f, 1.0f / 512.0f}
+};
+
+inline bool same_on_wire(vec2 first, vec2 second, const FixedPoint& format) {
+    return format.quantize(first.x) == format.quantize(second.x) && format.quantize(first.y) == format.quantize(second.y);
+}
+
+inline uint8_t changed_fields(const GameObject& from, const GameObject& to) {
+    uint8_t fields = 0;
+    if (!same_on_wire(from.position, to.position, s_object_format.position)) {
+        fields |= delta_position;
+    }
+    if (!same_on_wire(from.velocity, to.velocity, s_object_format.velocity)) {
+        fields |= delta_velocity;
+    }
+    if (s_object_format.radius.quantize(from.radius) != s_object_format.radius.quantize(to.radius)) {
+        fields |= delta_radius;
+    }
+    return fields;
+}
+
+// Ids in lists are ascending, so only gaps between them are written
+class IdWriter {
+public:
+    void write(BitWriter& bits, uint32_t id) {
+        bits.write_gamma(id - m_next);
+        m_next = id + 1;
+    }
+private:
+    uint32_t m_next = 0;
+};
+
+class IdReader {
+public:
+    uint32_t read(BitReader& bits) {
+        auto id = m_next + bits.read_gamma();
+        m_next = id + 1;
+        return id;
+    }
+private:
+    uint32_t m_next = 0;
+};
+
+inline void write_fields(BitWriter& bits, const GameObject& object, uint8_t fields) {
+    if (fields & delta_position) {
+        bits.write(object.position.x, s_object_format.position);
+        bits.write(object.position.y, s_object_format.position);
+    }
+    if (fields & delta_velocity) {
+        bits.write(object.velocity.x, s_object_format.velocity);
+        bits.write(object.velocity.y, s_object_format.velocity);
+    }
+    if (fields & delta_radius) {
+        bits.write(object.radius, s_object_format.radius);
+    }
+}
+
+inline void read_fields(BitReader& bits, GameObject& object, uint8_t fields) {
+    if (fields & delta_position) {
+        object.position.x = bits.read(s_object_format.position);
+        object.position.y = bits.read(s_object_format.position);
+    }
+    if (fields & delta_velocity) {
+        object.velocity.x = bits.read(s_object_format.velocity);
+        object.velocity.y = bits.read(s_object_format.velocity);
+    }
+    if (fields & delta_radius) {
+        object.radius = bits.read(s_object_format.radius);
+    }
+}
+
+// Objects have to be sorted by id
+inline void write_objects(OutByteStream& ostr, const std::vector<GameObject>& objects) {
+    BitWriter bits(ostr);
+    IdWriter ids;
+    bits.write_gamma(uint32_t(objects.size()));
+    for (const auto& object : objects) {
+        ids.write(bits, object.id);
+        write_fields(bits, object, delta_all);
+    }
+    bits.flush();
+}
+
+inline void read_objects(InByteStream& istr, std::vector<GameObject>& objects) {
+    BitReader bits(istr);
+    IdReader ids;
+    auto size = bits.read_gamma();
+    objects.clear();
+    objects.reserve(size);
+    for (uint32_t i = 0; i < size; ++i) {
+        GameObject object{};
+        object.id = ids.read(bits);
+        read_fields(bits, object, delta_all);
+        objects.push_back(object);
+    }
+}
+
+// Writes `current` as a difference from `baseline`: ids of removed objects,
+// then only those objects that are new or have changed, with a mask of changed fields.
+// Without baseline the full object list is written.
+inline void write_snapshot(OutByteStream& ostr, const ObjectsSnapshot& current, const ObjectsSnapshot* baseline) {
+    ostr << varint{current.sequence};
+    if (baseline == nullptr) {
+        ostr << varint{s_no_snapshot};
+        write_objects(ostr, current.objects);
+        return;
+    }
+    ostr << varint{baseline->sequence};
+
+    const auto& old_objects = baseline->objects;
+    const auto& new_objects = current.objects;
+    std::vector<uint32_t> removed;
+    std::vector<std::pair<size_t, uint8_t>> changed;
+    size_t old_idx = 0;
+    size_t new_idx = 0;
+    while (old_idx < old_objects.size() || new_idx < new_objects.size()) {
+        if (new_idx == new_objects.size() || (old_idx < old_objects.size() && old_objects[old_idx].id < new_objects[new_idx].id)) {
+            removed.push_back(old_objects[old_idx++].id);
+        } else if (old_idx == old_objects.size() || new_objects[new_idx].id < old_objects[old_idx].id) {
+            changed.emplace_back(new_idx++, delta_all);
+        } else {
+            auto fields = changed_fields(old_objects[old_idx++], new_objects[new_idx]);
+            if (fields != 0) {
+                changed.emplace_back(new_idx, fields);
+            }
+            ++new_idx;
+        }
+    }
+
+    BitWriter bits(ostr);
+    IdWriter removed_ids;
+    bits.write_gamma(uint32_t(removed.size()));
+    for (auto id : removed) {
+        removed_ids.write(bits, id);
+    }
+    IdWriter changed_ids;
+    bits.write_gamma(uint32_t(changed.size()));
+    for (auto [index, fields] : changed) {
+        const auto& object = new_objects[index];
+        changed_ids.write(bits, object.id);
+        bits.write(fields, s_delta_field_bits);
+        write_fields(bits, object, fields);
+    }
+    bits.flush();
+}
+
+// Restores snapshot written by write_snapshot.
+// Returns false if the baseline it refers to is not in the history.
+template<size_t SIZE>
+bool read_snapshot(InByteStream& istr, const SnapshotHistory<SIZE>& history, ObjectsSnapshot& result) {
+    result.sequence = istr.get<varint<uint32_t>>().value;
+    auto baseline_sequence = istr.get<varint<uint32_t>>().value;
+    if (baseline_sequence == s_no_snapshot) {
+        read_objects(istr, result.objects);
+        return true;
+    }
+    auto baseline = history.find(baseline_sequence);
+    if (baseline == nullptr) {
+        return false;
+    }
+
+    // removed ids are sorted like the baseline, so they are merged with it as they are read
+    BitReader bits(istr);
+    IdReader removed_ids;
+    constexpr auto no_more_removed = std::numeric_limits<uint32_t>::max();
+    auto num_removed = bits.read_gamma();
+    auto next_removed = [&]() {
+        if (num_removed == 0) {
+            return no_more_removed;
+        }
+        --num_removed;
+        return removed_ids.read(bits);
+    };
+    auto removed = next_removed();
+
+    result.objects.clear();
+    result.objects.reserve(baseline->objects.size());
+    for (const auto& object : baseline->objects) {
+        while (removed < object.id) {
+            removed = next_removed();
+        }
+        if (object.id == removed) {
+            removed = next_removed();
+        } else {
+            result.objects.push_back(object);
+        }
+    }
+    while (num_removed > 0) {
+        next_removed();
+    }
+
+    IdReader changed_ids;
+    auto num_changed = bits.read_gamma();
+    for (uint32_t i = 0; i < num_changed; ++i) {
+        GameObject update{};
+        update.id = changed_ids.read(bits);
+        auto fields = uint8_t(bits.read(s_delta_field_bits));
+        auto it = std::lower_bound(result.objects.begin(), result.objects.end(), update.id, [](const GameObject& object, uint32_t id) {
+            return object.id < id;
+        });
+        if (it == result.objects.end() || it->id != update.id) {
+            it = result.objects.insert(it, update);
+        }
+        read_fields(bits, *it, fields);
+    }
+    return true;
+}
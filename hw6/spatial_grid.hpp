@@ -0,0 +1,238 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "game_object.hpp"
+#include "object_store.hpp"
+
+
+// Uniform grid over the simulation area used as a collision broad phase.
+// Objects are stored by their index in the objects array and are put into
+// every cell their bounding box touches, so two intersecting objects
+// always share at least one cell, whatever their radii are.
+class SpatialGrid {
+    using cell_t = std::vector<uint32_t>;
+    static constexpr uint32_t s_max_cells_per_side = 256;
+
+    struct CellRange {
+        uint32_t min_x, min_y, max_x, max_y;
+
+        bool operator==(const CellRange&) const = default;
+    };
+
+public:
+    SpatialGrid(vec2 borders): m_borders(borders) {}
+
+    // Moves objects between cells, rebuilding the whole grid
+    // only if the objects array has changed size since the last call.
+    void update(const ObjectStore& objects) {
+        if (m_dirty || objects.size() != m_object_cells.size()) {
+            rebuild(objects);
+            return;
+        }
+
+        for (size_t i = 0; i < objects.size(); ++i) {
+            update_object(uint32_t(i), objects.position(i), objects.radius[i]);
+        }
+    }
+
+    void rebuild(const ObjectStore& objects) {
+        float radius_sum = 0.0f;
+        for (auto radius : objects.radius) {
+            radius_sum += radius;
+        }
+        float mean_radius = objects.empty() ? 1.0f : radius_sum / float(objects.size());
+        float max_dimension = std::max(m_borders.x, m_borders.y);
+        m_cell_size = std::clamp(
+                mean_radius * 2.0f,
+                max_dimension / float(s_max_cells_per_side),
+                max_dimension
+        );
+        m_width = cells_on_side(m_borders.x);
+        m_height = cells_on_side(m_borders.y);
+
+        m_cells.resize(size_t(m_width) * m_height);
+        for (auto& cell : m_cells) {
+            cell.clear();
+        }
+
+        m_object_cells.resize(objects.size());
+        for (size_t i = 0; i < objects.size(); ++i) {
+            auto range = cell_range(objects.position(i), objects.radius[i]);
+            m_object_cells[i] = range;
+            for_each_cell(range, [&](cell_t& cell) { cell.push_back(uint32_t(i)); });
+        }
+        m_dirty = false;
+    }
+
+    // Has to be called when objects were erased or reordered.
+    void invalidate() {
+        m_dirty = true;
+    }
+
+    void update_object(uint32_t index, vec2 position, float radius) {
+        auto new_range = cell_range(position, radius);
+        auto& old_range = m_object_cells[index];
+        if (new_range == old_range) {
+            return;
+        }
+        for_each_cell(old_range, [&](cell_t& cell) {
+            auto it = std::find(cell.begin(), cell.end(), index);
+            *it = cell.back();
+            cell.pop_back();
+        });
+        for_each_cell(new_range, [&](cell_t& cell) { cell.push_back(index); });
+        old_range = new_range;
+    }
+
+    // Calls func(j) for every object j sharing a cell with the object at index.
+    // The same j may be reported several times.
+    template<typename F>
+    void for_each_candidate(uint32_t index, F&& func) {
+        for_each_cell(m_object_cells[index], [&](const cell_t& cell) {
+            for (auto other : cell) {
+                func(other);
+            }
+        });
+    }
+
+    // Calls func(j) for every object j whose bounding box may overlap the given box.
+    // The same j may be reported several times.
+    template<typename F>
+    void for_each_in_box(vec2 min, vec2 max, F&& func) {
+        if (m_cells.empty()) {
+            return;
+        }
+        CellRange range = {
+            clamp_coord(min.x, m_width), clamp_coord(min.y, m_height),
+            clamp_coord(max.x, m_width), clamp_coord(max.y, m_height)
+        };
+        for_each_cell(range, [&](const cell_t& cell) {
+            for (auto other : cell) {
+                func(other);
+            }
+        });
+    }
+
+private:
+    vec2 m_borders;
+    float m_cell_size = 1.0f;
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    bool m_dirty = true;
+    std::vector<cell_t> m_cells;
+    std::vector<CellRange> m_object_cells;
+
+    template<typename F>
+    void for_each_cell(const CellRange& range, F&& func) {
+        for (uint32_t y = range.min_y; y <= range.max_y; ++y) {
+            for (uint32_t x = range.min_x; x <= range.max_x; ++x) {
+                func(m_cells[y * m_width + x]);
+            }
+        }
+    }
+
+    uint32_t cells_on_side(float length) const {
+        return std::max(uint32_t(std::ceil(length / m_cell_size)), 1u);
+    }
+
+    uint32_t clamp_coord(float coord, uint32_t size) const {
+        if (coord != coord || coord < 0.0f) {
+            return 0;
+        }
+        return std::min(uint32_t(coord / m_cell_size), size - 1);
+    }
+
+    CellRange cell_range(vec2 position, float radius) const {
+        auto extent = vec2{radius, radius};
+        auto min = position - extent;
+        auto max = position + extent;
+        return {
+            clamp_coord(min.x, m_width), clamp_coord(min.y, m_height),
+            clamp_coord(max.x, m_width), clamp_coord(max.y, m_height)
+        };
+    }
+};
+
+inline float max_object_radius(vec2 borders) {
+    return std::max(borders.x, borders.y) / 8.0f;
+}
+
+// Bigger object eats the smaller one, smaller one is teleported.
+template<typename Teleport>
+void eat(GameObject& first, GameObject& second, float max_radius, Teleport&& teleport) {
+    bool first_is_smaller = first.radius < second.radius;
+    auto& bigger = first_is_smaller ? second : first;
+    auto& smaller = first_is_smaller ? first : second;
+
+    smaller.radius = std::max(smaller.radius / 2.0f, 0.2f);
+    bigger.radius = std::min(bigger.radius + smaller.radius, max_radius);
+    teleport(smaller);
+}
+
+inline bool intersect(const GameObject& first, const GameObject& second) {
+    return glm::distance(first.position, second.position) < first.radius + second.radius;
+}
+
+inline void eat(ObjectStore& objects, size_t first_index, size_t second_index, float max_radius, auto&& teleport) {
+    auto first = objects.get(first_index);
+    auto second = objects.get(second_index);
+    eat(first, second, max_radius, teleport);
+    objects.set(first_index, first);
+    objects.set(second_index, second);
+}
+
+inline bool intersect(const ObjectStore& objects, size_t first, size_t second) {
+    return intersect(objects.get(first), objects.get(second));
+}
+
+// Reference O(n^2) implementation, kept for benchmarks
+template<typename Teleport>
+void resolve_collisions_naive(ObjectStore& objects, float max_radius, Teleport&& teleport) {
+    for (size_t i = 0; i < objects.size(); ++i) {
+        for (size_t j = i + 1; j < objects.size(); ++j) {
+            if (intersect(objects, i, j)) {
+                eat(objects, i, j, max_radius, teleport);
+            }
+        }
+    }
+}
+
+// Same pair order and semantics as resolve_collisions_naive,
+// but only pairs reported by the grid are tested.
+template<typename Teleport>
+void resolve_collisions(ObjectStore& objects, SpatialGrid& grid, float max_radius, Teleport&& teleport) {
+    grid.update(objects);
+    std::vector<uint32_t> candidates;
+    for (uint32_t i = 0; i < objects.size(); ++i) {
+        auto collect = [&](uint32_t after) {
+            candidates.clear();
+            grid.for_each_candidate(i, [&](uint32_t j) {
+                if (j > after) {
+                    candidates.push_back(j);
+                }
+            });
+            std::sort(candidates.begin(), candidates.end());
+            candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+        };
+        collect(i);
+        size_t next = 0;
+        while (next < candidates.size()) {
+            auto j = candidates[next++];
+            if (!intersect(objects, i, j)) {
+                continue;
+            }
+            eat(objects, i, j, max_radius, teleport);
+            grid.update_object(i, objects.position(i), objects.radius[i]);
+            grid.update_object(j, objects.position(j), objects.radius[j]);
+            // i has either moved or grown, so the rest of its candidates may have changed
+            collect(j);
+            next = 0;
+        }
+    }
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/resource.h>
+#endif
+
+#include <ftxui/dom/elements.hpp>
+#include <ftxui/dom/table.hpp>
+#include <ftxui/screen/screen.hpp>
+
+#include "common.hpp"
+
+
+// Single producer, single consumer exchange of the latest value without locks.
+// Writer fills back() and publishes it, reader takes the latest published value,
+// values published in between are skipped.
+template<typename T>
+class TripleBuffer {
+    static constexpr uint8_t s_index_mask = 0b11;
+    static constexpr uint8_t s_fresh = 0b100;
+
+public:
+    T& back() {
+        return m_buffers[m_back];
+    }
+
+    void publish() {
+        m_back = m_middle.exchange(m_back | s_fresh, std::memory_order_acq_rel) & s_index_mask;
+    }
+
+    // Returns nullptr if nothing was published since the last call
+    const T* consume() {
+        if ((m_middle.load(std::memory_order_relaxed) & s_fresh) == 0) {
+            return nullptr;
+        }
+        m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & s_index_mask;
+        return &m_buffers[m_front];
+    }
+
+private:
+    std::array<T, 3> m_buffers;
+    uint8_t m_back = 0;
+    std::atomic<uint8_t> m_middle = 1;
+    uint8_t m_front = 2;
+};
+
+// Table of players printed to the terminal from a separate low priority thread,
+// so that the game tick only copies player stats.
+class StatusDisplay {
+public:
+    StatusDisplay(std::chrono::milliseconds period)
+        : m_thread([this, period](std::stop_token stop) { run(stop, period); })
+    {}
+
+    void publish(const std::vector<Player>& players) {
+        m_players.back() = players;
+        m_players.publish();
+    }
+
+private:
+    TripleBuffer<std::vector<Player>> m_players;
+    size_t m_last_num_players = 0;
+    std::jthread m_thread;
+
+    void run(std::stop_token stop, std::chrono::milliseconds period) {
+#ifdef __linux__
+        // nice value is per thread on linux
+        setpriority(PRIO_PROCESS, 0, 19);
+#endif
+        std::mutex mutex;
+        std::condition_variable_any wakeup;
+        std::unique_lock lock(mutex);
+        while (!wakeup.wait_for(lock, stop, period, [] { return false; })) {
+            if (auto players = m_players.consume()) {
+                render(*players);
+            }
+        }
+    }
+
+    void render(const std::vector<Player>& players) {
+        using namespace ftxui;
+        std::vector<std::vector<Element>> table_data;
+        table_data.reserve(players.size() + 1);
+        auto header_data = { "id", "login", "ping", "ip", "port" };
+        std::vector<Element> header;
+        header.reserve(header_data.size());
+        std::transform(header_data.begin(), header_data.end(), std::back_inserter(header), [](const auto& item) { return text(item); });
+        table_data.push_back(std::move(header));
+        for (const auto& player : players) {
+            auto row_data = {
+                std::to_string(player.id),
+                player.name,
+                std::to_string(player.ping),
+                std::to_string(player.address.host),
+                std::to_string(player.address.port)
+            };
+            std::vector<Element> row;
+            std::transform(row_data.begin(), row_data.end(), std::back_inserter(row), [](const auto& item) { return text(item); });
+            table_data.push_back(std::move(row));
+        }
+
+        auto table = Table(table_data);
+
+        table.SelectAll().Border(LIGHT);
+
+        table.SelectColumn(0).Border(LIGHT);
+
+        table.SelectRow(0).Decorate(bold);
+        table.SelectRow(0).SeparatorVertical(LIGHT);
+        table.SelectRow(0).Border(DOUBLE);
+
+        auto content = table.SelectRows(1, -1);
+        content.DecorateCellsAlternateRow(color(Color::Blue), 3, 0);
+        content.DecorateCellsAlternateRow(color(Color::Cyan), 3, 1);
+        content.DecorateCellsAlternateRow(color(Color::White), 3, 2);
+
+        auto document = table.Render();
+        auto screen = Screen::Create(Dimension::Full(), Dimension::Fit(document));
+        Render(screen, document);
+        screen.Print();
+        std::cout << screen.ResetPosition();
+        if (m_last_num_players > players.size()) {
+            std::cout << std::endl;
+        }
+        m_last_num_players = players.size();
+    }
+};
@@ -1,57 +1,164 @@
 #pragma once
 
+#include <algorithm>
 #include <chrono>
+#include <cstdint>
 #include <functional>
-#include <list>
-#include <iostream>
+#include <vector>
+
+#include "slot_index.hpp"
 
 
 using namespace std::chrono_literals;
+
+// What a periodic task does when launch() was called too late to run it on time
+enum class MissedRuns {
+    // missed runs are executed one per launch() until the task is back on schedule
+    catch_up,
+    // missed runs are dropped, the task keeps its phase
+    skip
+};
+
+// Periodic tasks ordered by their absolute deadlines in a binary heap.
+// Deadlines advance by whole periods, so tasks don't drift when launch() is late.
+// Returning false from a task removes it.
 template <typename task_clock_t>
 class TimedTaskManager {
+    using time_point_t = typename task_clock_t::time_point;
+
     struct TimerTask {
         std::chrono::milliseconds execution_period;
         std::function<bool(void)> task;
-        typename task_clock_t::time_point last_execution{task_clock_t::now() - execution_period};
+        MissedRuns missed_runs;
+        uint32_t id;
+    };
+
+    struct Deadline {
+        time_point_t time;
+        // tasks with the same deadline run in the order they were scheduled
+        uint64_t order;
+        uint32_t task_id;
+
+        bool operator>(const Deadline& other) const {
+            return time != other.time ? time > other.time : order > other.order;
+        }
     };
+
 public:
+    static constexpr uint32_t s_invalid_task = SlotIndex::s_invalid;
+
     size_t launch() {
         auto current_time = task_clock_t::now();
+        // tasks rescheduled during this call don't run again until the next one
+        m_due.clear();
+        while (!m_deadlines.empty() && m_deadlines.front().time <= current_time) {
+            m_due.push_back(pop_deadline());
+        }
+
         size_t tasks_launched = 0;
-        for (auto it = m_tasks.begin(); it != m_tasks.end(); ++it) {
-            auto& task = *it;
-            auto since_last_execution = std::chrono::duration_cast<std::chrono::milliseconds>(
-                    current_time - task.last_execution
-            );
-            if (since_last_execution > task.execution_period) {
-                if (!task.task()) {
-                   auto copy = it;
-                   --copy;
-                   m_tasks.erase(it);
-                   it = copy;
-                } else {
-                   task.last_execution = current_time;
-                }
-                ++tasks_launched;
-            }          
+        for (const auto& deadline : m_due) {
+            auto index = m_index.find(deadline.task_id);
+            if (index == SlotIndex::s_invalid) {
+                // cancelled by one of the tasks launched before
+                continue;
+            }
+            // task may add or cancel tasks, so it's moved out of the array while it runs
+            auto func = std::move(m_tasks[index].task);
+            bool keep = func();
+            ++tasks_launched;
+
+            index = m_index.find(deadline.task_id);
+            if (index == SlotIndex::s_invalid) {
+                continue;
+            }
+            if (!keep) {
+                erase(deadline.task_id, index);
+                continue;
+            }
+            auto& task = m_tasks[index];
+            task.task = std::move(func);
+            push_deadline(next_run(task, deadline.time, current_time), task.id);
         }
+        drop_cancelled();
         return tasks_launched;
     }
 
+    // First run happens after first_delay + launch_interval
     template<typename F>
-    void add_task(
-            F&& func, 
-            std::chrono::milliseconds launch_interval, 
-            std::chrono::milliseconds first_delay = 0ms
+    uint32_t add_task(
+            F&& func,
+            std::chrono::milliseconds launch_interval,
+            std::chrono::milliseconds first_delay = 0ms,
+            MissedRuns missed_runs = MissedRuns::skip
     ) {
-        m_tasks.emplace_back(
-                launch_interval, 
-                std::forward<F>(func), 
-                task_clock_t::now() + first_delay
-        );
+        auto id = m_index.insert(uint32_t(m_tasks.size()));
+        m_tasks.push_back({launch_interval, std::forward<F>(func), missed_runs, id});
+        push_deadline(task_clock_t::now() + first_delay + launch_interval, id);
+        return id;
+    }
+
+    // Returns false if there is no such task, e.g. it has already finished
+    bool cancel(uint32_t id) {
+        auto index = m_index.find(id);
+        if (index == SlotIndex::s_invalid) {
+            return false;
+        }
+        erase(id, index);
+        drop_cancelled();
+        return true;
+    }
+
+    // Time when the earliest task becomes due, time_point::max() if there are no tasks
+    time_point_t next_deadline() const {
+        return m_deadlines.empty() ? time_point_t::max() : m_deadlines.front().time;
+    }
+
+    size_t size() const {
+        return m_tasks.size();
     }
 
 private:
-    std::list<TimerTask> m_tasks;
-};
+    std::vector<TimerTask> m_tasks;
+    SlotIndex m_index;
+    // min-heap, entries of cancelled tasks stay here until they reach the top
+    std::vector<Deadline> m_deadlines;
+    std::vector<Deadline> m_due;
+    uint64_t m_order = 0;
+
+    static time_point_t next_run(const TimerTask& task, time_point_t deadline, time_point_t current_time) {
+        auto next = deadline + task.execution_period;
+        if (task.missed_runs == MissedRuns::skip && next <= current_time && task.execution_period.count() > 0) {
+            auto missed = (current_time - next) / task.execution_period + 1;
+            next += missed * task.execution_period;
+        }
+        return next;
+    }
+
+    void push_deadline(time_point_t time, uint32_t id) {
+        m_deadlines.push_back({time, m_order++, id});
+        std::push_heap(m_deadlines.begin(), m_deadlines.end(), std::greater<>{});
+    }
 
+    Deadline pop_deadline() {
+        std::pop_heap(m_deadlines.begin(), m_deadlines.end(), std::greater<>{});
+        auto deadline = m_deadlines.back();
+        m_deadlines.pop_back();
+        return deadline;
+    }
+
+    // keeps next_deadline() exact
+    void drop_cancelled() {
+        while (!m_deadlines.empty() && m_index.find(m_deadlines.front().task_id) == SlotIndex::s_invalid) {
+            pop_deadline();
+        }
+    }
+
+    void erase(uint32_t id, uint32_t index) {
+        if (index + 1 != m_tasks.size()) {
+            m_tasks[index] = std::move(m_tasks.back());
+            m_index.relocate(m_tasks[index].id, index);
+        }
+        m_tasks.pop_back();
+        m_index.erase(id);
+    }
+};
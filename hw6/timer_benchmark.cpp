@@ -0,0 +1,96 @@
+#include <chrono>
+#include <functional>
+#include <list>
+#include <random>
+
+#include <spdlog/spdlog.h>
+
+#include "timed_task_manager.hpp"
+
+
+// Clock moved by the benchmark, so both managers see exactly the same frames
+struct ManualClock {
+    using duration = std::chrono::nanoseconds;
+    using rep = duration::rep;
+    using period = duration::period;
+    using time_point = std::chrono::time_point<ManualClock>;
+    static constexpr bool is_steady = true;
+
+    static time_point now() {
+        return s_now;
+    }
+
+    inline static time_point s_now;
+};
+
+// Previous implementation: every task is checked on every launch, period is counted from the last run
+template <typename task_clock_t>
+class ListTaskManager {
+    struct TimerTask {
+        std::chrono::milliseconds execution_period;
+        std::function<bool(void)> task;
+        typename task_clock_t::time_point last_execution;
+    };
+public:
+    size_t launch() {
+        auto current_time = task_clock_t::now();
+        size_t tasks_launched = 0;
+        for (auto& task : m_tasks) {
+            auto since_last_execution = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    current_time - task.last_execution
+            );
+            if (since_last_execution > task.execution_period) {
+                task.task();
+                task.last_execution = current_time;
+                ++tasks_launched;
+            }
+        }
+        return tasks_launched;
+    }
+
+    template<typename F>
+    void add_task(F&& func, std::chrono::milliseconds launch_interval) {
+        m_tasks.push_back({launch_interval, std::forward<F>(func), task_clock_t::now()});
+    }
+
+private:
+    std::list<TimerTask> m_tasks;
+};
+
+static constexpr size_t s_tasks = 10'000;
+static constexpr auto s_frame = 1ms;
+static constexpr auto s_duration = 10s;
+static constexpr auto s_tick_period = 60ms;
+
+template<typename Manager>
+static void run(const char* name) {
+    ManualClock::s_now = {};
+    Manager manager;
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<int> period_distribution(10, 1000);
+    size_t work = 0;
+    for (size_t i = 0; i < s_tasks; ++i) {
+        manager.add_task([&work] { ++work; return true; }, std::chrono::milliseconds(period_distribution(generator)));
+    }
+    size_t ticks = 0;
+    manager.add_task([&ticks] { ++ticks; return true; }, s_tick_period);
+
+    size_t launched = 0;
+    auto frames = s_duration / s_frame;
+    auto start = std::chrono::steady_clock::now();
+    for (int64_t frame = 0; frame < frames; ++frame) {
+        ManualClock::s_now += s_frame;
+        launched += manager.launch();
+    }
+    auto end = std::chrono::steady_clock::now();
+    auto total_us = std::chrono::duration<double, std::micro>(end - start).count();
+
+    spdlog::info("{:>5}: {:>8.3f} us/launch, {:>6.1f} ns/dispatch, {} dispatches, {}ms task ran {} times (expected {})",
+            name, total_us / double(frames), total_us * 1000.0 / double(launched), launched,
+            s_tick_period.count(), ticks, s_duration / s_tick_period);
+}
+
+int main() {
+    run<ListTaskManager<ManualClock>>("list");
+    run<TimedTaskManager<ManualClock>>("heap");
+}